@@ -27,4 +27,70 @@
 #define MXS_VDDDBO 3
 #define MXS_OVERALL_CUR 4
 
+#include <linux/list.h>
+
+struct mxs_regulator;
+struct regulator_dev;
+struct regulator_init_data;
+struct regulator_ops;
+
+/*
+ * one rail of the power block, see mxs_register_regulators(). ops is
+ * optional, rails without it go through rdata via the generic ops.
+ */
+struct mxs_regulator_rail {
+	struct mxs_regulator *sreg;
+	int id;
+	struct regulator_init_data *initdata;
+	struct regulator_ops *ops;
+	/* optional, registered on the rail's notifier chain */
+	struct notifier_block *nb;
+
+	/* private to the regulator driver */
+	struct regulator_dev *rdev;
+	struct list_head node;
+	int allocated;
+};
+
+/*
+ * DVFS operating point, see mxs_power_set_opp(). cur_uA is the budget
+ * charged to the cpufreq current sibling at this point, speed_min the
+ * ARM speed sensor count AVS has to keep.
+ */
+struct mxs_power_opp {
+	unsigned int cpu_khz;
+	unsigned int emi_khz;
+	int vddd_uV;
+	int vddd_bo_uV;
+	int cur_uA;
+	unsigned int speed_min;
+
+	/* private to the power code */
+	int vddd_code;
+	int bo_offs;
+	int avs_code;
+	int avs_verified;
+};
+
+int mxs_register_regulators(struct mxs_regulator_rail *rails, int num);
+void mxs_unregister_regulators(struct mxs_regulator_rail *rails, int num);
+void mxs_unregister_regulator(struct mxs_regulator *reg_data);
+void mxs_power_regs_sync(void);
+int mxs_regulator_set_voltage_time(int id, int old_uV, int new_uV);
+
+int mxs_power_opp_count(void);
+const struct mxs_power_opp *mxs_power_get_opp(int index);
+int mxs_power_set_opp(int index,
+		      int (*set_clocks)(const struct mxs_power_opp *opp,
+					void *data),
+		      void *data);
+int mxs_power_speed_get(unsigned int sel, u32 *age_us);
+
+int mxs_platform_add_regulator(const char *name, int count);
+int mxs_platform_del_regulator(const char *name, int count);
+int mxs_platform_set_current_coalesce(const char *name,
+				      unsigned int window_ms);
+int mxs_platform_set_current_pm(const char *name, int pm);
+int mxs_platform_set_current_shed(const char *name, int shed);
+
 #endif
@@ -0,0 +1,407 @@
+/*
+ * Freescale i.MX28 POWER block model
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * A register level model of the POWER block which power.c talks to
+ * instead of the hardware when CONFIG_MXS_POWER_SIM is set, so the
+ * regulator drivers can be exercised and timed without a board.
+ *
+ * Every register in regs-power.h is backed by storage, with the
+ * SET/CLR/TOG aliases where the hardware has them. On top of that:
+ *  - changing a rail's TRG drops DC_OK until the rail has settled,
+ *    which takes settle_us of that rail
+ *  - a rail whose output is below TRG - BO_OFFSET flags its brownout
+ *    in STS and latches the brownout IRQ in CTRL
+ *  - VBUS and battery voltages are inputs (debugfs mxs-power/sim/)
+ *    which drive VBUSVALID, VDD5V_GT_VDDIO, VDD5V_DROOP, BATT_VAL and
+ *    the battery brownout
+ *  - the speed sensor counts in proportion to the vddd headroom
+ * The model is evaluated lazily on every access, it has no timers.
+ *
+ * Time comes from mxs_power_sim_now(). With sim/virtual_time set it is
+ * a clock that only moves when the driver delays through
+ * mxs_power_sim_delay(), so a timeout costs no real time and a run is
+ * repeatable to the bit. Switch it while the rails are idle.
+ *
+ * This is not a host program and nothing runs it on its own: the model
+ * is linked into an ARM kernel for the mx28 (on an EVK or under an
+ * emulator), in place of the register accesses, and is driven from
+ * debugfs by hand. The mach-mx28 Kconfig and Makefile are not part of
+ * this tree; a kernel that carries them needs
+ *   config MXS_POWER_SIM
+ *	bool "Run the POWER block drivers against a model"
+ *	depends on ARCH_MX28 && DEBUG_FS
+ * and
+ *   obj-$(CONFIG_MXS_POWER_SIM) += power-sim.o
+ * Never enable it on a kernel meant to drive real hardware, the rails
+ * are then left at whatever the boot loader set.
+ */
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+
+#include <mach/regs-power.h>
+
+#include "power-sim.h"
+
+#define SIM_REG_STRIDE	0x10
+#define SIM_NUM_REGS	(0x180 / SIM_REG_STRIDE)
+#define SIM_REG_BIT(reg)	(1 << ((reg) / SIM_REG_STRIDE))
+
+#define SIM_SCT_REGS	(SIM_REG_BIT(HW_POWER_CTRL) | \
+			 SIM_REG_BIT(HW_POWER_5VCTRL) | \
+			 SIM_REG_BIT(HW_POWER_MINPWR) | \
+			 SIM_REG_BIT(HW_POWER_CHARGE) | \
+			 SIM_REG_BIT(HW_POWER_LOOPCTRL) | \
+			 SIM_REG_BIT(HW_POWER_SPEED) | \
+			 SIM_REG_BIT(HW_POWER_RESET) | \
+			 SIM_REG_BIT(HW_POWER_DEBUG) | \
+			 SIM_REG_BIT(HW_POWER_THERMAL) | \
+			 SIM_REG_BIT(HW_POWER_USB1CTRL) | \
+			 SIM_REG_BIT(HW_POWER_SPECIAL) | \
+			 SIM_REG_BIT(HW_POWER_ANACLKCTRL) | \
+			 SIM_REG_BIT(HW_POWER_REFCTRL))
+
+#define SIM_RO_REGS	(SIM_REG_BIT(HW_POWER_STS) | \
+			 SIM_REG_BIT(HW_POWER_VERSION))
+
+struct sim_rail {
+	const char *name;
+	unsigned int reg;
+	int min_mv;
+	int step_mv;
+	u32 max_trg;
+	u32 sts_bo;
+	u32 irq_bo;
+
+	u32 settle_us;
+	int out_mv;
+	int target_mv;
+	s64 settle_at;
+};
+
+static struct sim_rail sim_rails[] = {
+	{
+		.name		= "vddd",
+		.reg		= HW_POWER_VDDDCTRL,
+		.min_mv		= 800,
+		.step_mv	= 25,
+		.max_trg	= 0x1f,
+		.sts_bo		= BM_POWER_STS_VDDD_BO,
+		.irq_bo		= BM_POWER_CTRL_VDDD_BO_IRQ,
+		.settle_us	= 50,
+	},
+	{
+		.name		= "vdda",
+		.reg		= HW_POWER_VDDACTRL,
+		.min_mv		= 1500,
+		.step_mv	= 25,
+		.max_trg	= 0x1f,
+		.sts_bo		= BM_POWER_STS_VDDA_BO,
+		.irq_bo		= BM_POWER_CTRL_VDDA_BO_IRQ,
+		.settle_us	= 50,
+	},
+	{
+		.name		= "vddio",
+		.reg		= HW_POWER_VDDIOCTRL,
+		.min_mv		= 2800,
+		.step_mv	= 50,
+		.max_trg	= 0x10,
+		.sts_bo		= BM_POWER_STS_VDDIO_BO,
+		.irq_bo		= BM_POWER_CTRL_VDDIO_BO_IRQ,
+		.settle_us	= 100,
+	},
+};
+
+/* reset values, plausible rather than exact */
+static u32 sim_regs[SIM_NUM_REGS] = {
+	[HW_POWER_5VCTRL / SIM_REG_STRIDE]	= 0x00000300,
+	[HW_POWER_VDDDCTRL / SIM_REG_STRIDE]	= 0x0000040e,
+	[HW_POWER_VDDACTRL / SIM_REG_STRIDE]	= 0x0000040c,
+	[HW_POWER_VDDIOCTRL / SIM_REG_STRIDE]	= 0x0000040a,
+	[HW_POWER_VDDMEMCTRL / SIM_REG_STRIDE]	= 0x00000110,
+	[HW_POWER_BATTMONITOR / SIM_REG_STRIDE]	= 0x00000008,
+	[HW_POWER_VERSION / SIM_REG_STRIDE]	= 0x04000000,
+};
+
+/* inputs, in mV */
+static u32 sim_vbus_mv = 5000;
+static u32 sim_batt_mv = 4200;
+
+static u32 sim_reads;
+static u32 sim_writes;
+
+static DEFINE_SPINLOCK(sim_lock);
+static int sim_initialized;
+
+static u32 sim_virtual_time;
+static u64 sim_vclock_ns;
+
+/* must be called with sim_lock held */
+static s64 sim_now(void)
+{
+	if (!sim_virtual_time)
+		return ktime_to_ns(ktime_get());
+
+	/* start from real time so settle_at stamps stay in the past */
+	if (!sim_vclock_ns)
+		sim_vclock_ns = ktime_to_ns(ktime_get());
+	return sim_vclock_ns;
+}
+
+s64 mxs_power_sim_now(void)
+{
+	unsigned long flags;
+	s64 now;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	now = sim_now();
+	spin_unlock_irqrestore(&sim_lock, flags);
+
+	return now;
+}
+
+/* returns 0 when the caller has to wait for real */
+int mxs_power_sim_delay(unsigned long us)
+{
+	unsigned long flags;
+
+	if (!ACCESS_ONCE(sim_virtual_time))
+		return 0;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	sim_vclock_ns = sim_now() + (u64)us * NSEC_PER_USEC;
+	spin_unlock_irqrestore(&sim_lock, flags);
+
+	return 1;
+}
+
+static inline u32 *sim_reg(unsigned int reg)
+{
+	return &sim_regs[reg / SIM_REG_STRIDE];
+}
+
+static int sim_trg_mv(struct sim_rail *rail, u32 val)
+{
+	u32 trg = min(val & 0x1f, rail->max_trg);
+
+	return rail->min_mv + trg * rail->step_mv;
+}
+
+static int sim_bo_mv(struct sim_rail *rail, u32 val)
+{
+	/* a BO_OFFSET step is a TRG step, 50 mV on vddio */
+	return sim_trg_mv(rail, val) - rail->step_mv * ((val >> 8) & 0x7);
+}
+
+static void sim_init(s64 now)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim_rails); i++) {
+		struct sim_rail *rail = &sim_rails[i];
+
+		rail->target_mv = sim_trg_mv(rail, *sim_reg(rail->reg));
+		rail->out_mv = rail->target_mv;
+		rail->settle_at = now;
+	}
+	sim_initialized = 1;
+}
+
+/* VBUS droop threshold selected by 5VCTRL VBUSDROOP_TRSH */
+static int sim_droop_mv(void)
+{
+	static const int trsh[] = { 4300, 4400, 4500, 4700 };
+	u32 v = *sim_reg(HW_POWER_5VCTRL);
+
+	return trsh[(v & BM_POWER_5VCTRL_VBUSDROOP_TRSH) >>
+		    BP_POWER_5VCTRL_VBUSDROOP_TRSH];
+}
+
+/* bring STS, CTRL, BATTMONITOR and SPEED up to date, sim_lock held */
+static void sim_update(s64 now)
+{
+	u32 sts = 0, old_sts = *sim_reg(HW_POWER_STS);
+	u32 *ctrl = sim_reg(HW_POWER_CTRL);
+	u32 *batt = sim_reg(HW_POWER_BATTMONITOR);
+	u32 *speed = sim_reg(HW_POWER_SPEED);
+	int settled = 1;
+	u32 lvl;
+	int i;
+
+	if (!sim_initialized)
+		sim_init(now);
+
+	for (i = 0; i < ARRAY_SIZE(sim_rails); i++) {
+		struct sim_rail *rail = &sim_rails[i];
+
+		if (now >= rail->settle_at)
+			rail->out_mv = rail->target_mv;
+		else
+			settled = 0;
+
+		if (rail->out_mv < sim_bo_mv(rail, *sim_reg(rail->reg))) {
+			sts |= rail->sts_bo;
+			*ctrl |= rail->irq_bo;
+		}
+	}
+	if (settled)
+		sts |= BM_POWER_STS_DC_OK;
+
+	if (sim_vbus_mv >= 4400)
+		sts |= BM_POWER_STS_VBUSVALID0;
+	if (sim_vbus_mv > sim_rails[2].out_mv)
+		sts |= BM_POWER_STS_VDD5V_GT_VDDIO;
+	if (sim_vbus_mv < sim_droop_mv())
+		sts |= BM_POWER_STS_VDD5V_DROOP;
+
+	*batt &= ~BM_POWER_BATTMONITOR_BATT_VAL;
+	*batt |= BF_POWER_BATTMONITOR_BATT_VAL(sim_batt_mv / 8);
+	lvl = *batt & BM_POWER_BATTMONITOR_BRWNOUT_LVL;
+	if (sim_batt_mv < 2400 + 40 * lvl)
+		sts |= BM_POWER_STS_BATT_BO;
+
+	if ((sts & ~old_sts) & BM_POWER_STS_VDD5V_DROOP)
+		*ctrl |= BM_POWER_CTRL_VDD5V_DROOP_IRQ;
+	if ((sts ^ old_sts) & BM_POWER_STS_VBUSVALID0)
+		*ctrl |= BM_POWER_CTRL_VBUSVALID_IRQ;
+	if ((sts ^ old_sts) & BM_POWER_STS_VDD5V_GT_VDDIO)
+		*ctrl |= BM_POWER_CTRL_VDD5V_GT_VDDIO_IRQ;
+	if ((sts & ~old_sts) & BM_POWER_STS_BATT_BO)
+		*ctrl |= BM_POWER_CTRL_BATT_BO_IRQ;
+	if ((sts & ~old_sts) & BM_POWER_STS_DC_OK)
+		*ctrl |= BM_POWER_CTRL_DC_OK_IRQ;
+
+	*sim_reg(HW_POWER_STS) = (old_sts & BM_POWER_STS_PWRUP_SOURCE) | sts;
+
+	/* the ring oscillators speed up with the vddd headroom */
+	*speed &= ~BM_POWER_SPEED_STATUS;
+	if (*speed & BM_POWER_SPEED_CTRL) {
+		int count = (sim_rails[0].out_mv - 600) * 8;
+		u32 sel = (*speed & BM_POWER_SPEED_STATUS_SEL) >>
+			BP_POWER_SPEED_STATUS_SEL;
+
+		if (sel == BV_POWER_SPEED_STATUS_SEL__ARM_STAT)
+			count = count * 9 / 10;
+		else if (sel == BV_POWER_SPEED_STATUS_SEL__DCDC_STAT)
+			count = count * 11 / 10;
+		*speed |= BF_POWER_SPEED_STATUS(max(count, 0));
+	}
+}
+
+static void sim_rail_written(s64 now, unsigned int reg)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim_rails); i++) {
+		struct sim_rail *rail = &sim_rails[i];
+		int mv;
+
+		if (rail->reg != reg)
+			continue;
+		mv = sim_trg_mv(rail, *sim_reg(reg));
+		if (mv == rail->target_mv)
+			return;
+		rail->target_mv = mv;
+		rail->settle_at = now + (s64)rail->settle_us * NSEC_PER_USEC;
+		return;
+	}
+}
+
+u32 mxs_power_sim_readl(unsigned int reg)
+{
+	unsigned long flags;
+	u32 val;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	sim_reads++;
+	sim_update(sim_now());
+	val = *sim_reg(reg & ~0xf);
+	spin_unlock_irqrestore(&sim_lock, flags);
+
+	return val;
+}
+
+void mxs_power_sim_writel(u32 val, unsigned int reg)
+{
+	unsigned int base = reg & ~0xf;
+	u32 *r = sim_reg(base);
+	u32 keep = 0;
+	unsigned long flags;
+	s64 now;
+
+	if (SIM_RO_REGS & SIM_REG_BIT(base))
+		return;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	sim_writes++;
+	now = sim_now();
+	sim_update(now);
+
+	/* status fields the model owns are not writable */
+	if (base == HW_POWER_BATTMONITOR)
+		keep = BM_POWER_BATTMONITOR_BATT_VAL;
+	else if (base == HW_POWER_SPEED)
+		keep = BM_POWER_SPEED_STATUS;
+	val &= ~keep;
+
+	switch (reg & 0xf) {
+	case 0x0:
+		*r = (*r & keep) | val;
+		break;
+	case 0x4:
+		if (SIM_SCT_REGS & SIM_REG_BIT(base))
+			*r |= val;
+		break;
+	case 0x8:
+		if (SIM_SCT_REGS & SIM_REG_BIT(base))
+			*r &= ~val;
+		break;
+	case 0xc:
+		if (SIM_SCT_REGS & SIM_REG_BIT(base))
+			*r ^= val;
+		break;
+	}
+
+	sim_rail_written(now, base);
+	sim_update(now);
+	spin_unlock_irqrestore(&sim_lock, flags);
+}
+
+void mxs_power_sim_debugfs(struct dentry *parent)
+{
+	struct dentry *dir;
+	char name[32];
+	int i;
+
+	dir = debugfs_create_dir("sim", parent);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_u32("vbus_mv", S_IRUGO | S_IWUSR, dir, &sim_vbus_mv);
+	debugfs_create_u32("batt_mv", S_IRUGO | S_IWUSR, dir, &sim_batt_mv);
+	debugfs_create_u32("reads", S_IRUGO | S_IWUSR, dir, &sim_reads);
+	debugfs_create_u32("writes", S_IRUGO | S_IWUSR, dir, &sim_writes);
+	debugfs_create_bool("virtual_time", S_IRUGO | S_IWUSR, dir,
+			    &sim_virtual_time);
+	debugfs_create_u64("vclock_ns", S_IRUGO | S_IWUSR, dir,
+			   &sim_vclock_ns);
+	for (i = 0; i < ARRAY_SIZE(sim_rails); i++) {
+		snprintf(name, sizeof(name), "%s_settle_us",
+			 sim_rails[i].name);
+		debugfs_create_u32(name, S_IRUGO | S_IWUSR, dir,
+				   &sim_rails[i].settle_us);
+	}
+}
@@ -0,0 +1,23 @@
+/*
+ * Freescale i.MX28 POWER block model
+ *
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#ifndef __MACH_MX28_POWER_SIM_H
+#define __MACH_MX28_POWER_SIM_H
+
+struct dentry;
+
+u32 mxs_power_sim_readl(unsigned int reg);
+void mxs_power_sim_writel(u32 val, unsigned int reg);
+void mxs_power_sim_debugfs(struct dentry *parent);
+s64 mxs_power_sim_now(void);
+int mxs_power_sim_delay(unsigned long us);
+
+#endif
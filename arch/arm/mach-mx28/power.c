@@ -17,16 +17,36 @@
  */
 /* #define DEBUG */
 
+#include <linux/init.h>
 #include <linux/device.h>
 #include <linux/delay.h>
 #include <linux/platform_device.h>
 #include <linux/regulator/consumer.h>
+#include <linux/regulator/driver.h>
 #include <linux/regulator/machine.h>
 #include <linux/io.h>
 #include <linux/slab.h>
 #include <linux/gpio.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/seqlock.h>
+#include <linux/random.h>
+#include <linux/uaccess.h>
+#include <linux/interrupt.h>
 
 #include "mx28_pins.h"
+#include "power-sim.h"
+#include <mach/mx28.h>
 #include <mach/power.h>
 #include <mach/regulator.h>
 #include <mach/regs-power.h>
@@ -34,538 +54,3834 @@
 #define USB_POWER_ENABLE MXS_PIN_TO_GPIO(PINID_AUART2_TX)
 #define MX28EVK_VBUS5v 5
 
-static int get_voltage(struct mxs_regulator *sreg)
+/*
+ * POWER block register access. Every access goes through these. The
+ * block is shared: CTRL, STS, SPEED and BATTMONITOR change under our
+ * feet, and the battery (ddi_power) and suspend code write the supply,
+ * charger and DC-DC registers behind our back. So only the fields this
+ * driver alone writes, TRG and BO_OFFSET of the DC-DC rails, are kept
+ * in power_cache. Reads of just those fields are served from it, full
+ * reads merge it into the hardware value, and mxs_power_regs_sync()
+ * puts them back on resume.
+ */
+#define POWER_REG_STRIDE	0x10
+#define POWER_NUM_REGS		(0x180 / POWER_REG_STRIDE)
+#define POWER_REG_BIT(reg)	(1 << ((reg) / POWER_REG_STRIDE))
+
+#define POWER_TRG_BO_MASK	(BM_POWER_VDDDCTRL_TRG | \
+				 BM_POWER_VDDDCTRL_BO_OFFSET)
+
+/* reserved offset between BATTMONITOR and RESET */
+#define POWER_HOLE_REGS		POWER_REG_BIT(0xf0)
+
+/* registers with _SET/_CLR/_TOG aliases */
+#define POWER_SCT_REGS		(POWER_REG_BIT(HW_POWER_CTRL) | \
+				 POWER_REG_BIT(HW_POWER_5VCTRL) | \
+				 POWER_REG_BIT(HW_POWER_MINPWR) | \
+				 POWER_REG_BIT(HW_POWER_CHARGE) | \
+				 POWER_REG_BIT(HW_POWER_LOOPCTRL) | \
+				 POWER_REG_BIT(HW_POWER_SPEED) | \
+				 POWER_REG_BIT(HW_POWER_RESET) | \
+				 POWER_REG_BIT(HW_POWER_DEBUG) | \
+				 POWER_REG_BIT(HW_POWER_THERMAL) | \
+				 POWER_REG_BIT(HW_POWER_USB1CTRL) | \
+				 POWER_REG_BIT(HW_POWER_SPECIAL) | \
+				 POWER_REG_BIT(HW_POWER_ANACLKCTRL) | \
+				 POWER_REG_BIT(HW_POWER_REFCTRL))
+
+/* the fields of reg only this driver writes */
+static inline u32 power_owned(unsigned int reg)
+{
+	switch (reg) {
+	case HW_POWER_VDDDCTRL:
+	case HW_POWER_VDDACTRL:
+	case HW_POWER_VDDIOCTRL:
+		return POWER_TRG_BO_MASK;
+	}
+	return 0;
+}
+
+#define SET_OFFSET		0x4
+#define CLR_OFFSET		0x8
+
+static u32 power_cache[POWER_NUM_REGS];	/* owned fields only */
+static u32 power_cache_valid;
+static u32 power_cache_dirty;
+static DEFINE_SPINLOCK(power_cache_lock);
+
+/* every access to the block, for mxs-power/bench */
+static u32 power_mmio_reads;
+static u32 power_mmio_writes;
+
+static inline u32 power_hw_readl(unsigned int reg)
+{
+	power_mmio_reads++;
+#ifdef CONFIG_MXS_POWER_SIM
+	/* talk to the model in power-sim.c instead of the hardware */
+	return mxs_power_sim_readl(reg);
+#else
+	return __raw_readl(REGS_POWER_BASE + reg);
+#endif
+}
+
+static inline void power_hw_writel(u32 val, unsigned int reg)
+{
+	power_mmio_writes++;
+#ifdef CONFIG_MXS_POWER_SIM
+	mxs_power_sim_writel(val, reg);
+#else
+	__raw_writel(val, REGS_POWER_BASE + reg);
+#endif
+}
+
+/*
+ * Time source and busy wait of the polling loops, the model can run
+ * them on virtual time.
+ */
+static inline u64 power_now_ns(void)
+{
+#ifdef CONFIG_MXS_POWER_SIM
+	return mxs_power_sim_now();
+#else
+	return ktime_to_ns(ktime_get());
+#endif
+}
+
+static inline void power_udelay(unsigned long us)
+{
+#ifdef CONFIG_MXS_POWER_SIM
+	if (mxs_power_sim_delay(us))
+		return;
+#endif
+	udelay(us);
+}
+
+static void power_sleep_us(unsigned long us)
+{
+#ifdef CONFIG_MXS_POWER_SIM
+	if (mxs_power_sim_delay(us))
+		return;
+#endif
+	if (us > 20000)
+		msleep(us / USEC_PER_MSEC);
+	else
+		usleep_range(us, us + 50);
+}
+
+/* must be called with power_cache_lock held */
+static void __power_cache_store(unsigned int reg, u32 val, int dirty)
+{
+	u32 owned = power_owned(reg);
+
+	if (!owned)
+		return;
+	power_cache[reg / POWER_REG_STRIDE] = val & owned;
+	power_cache_valid |= POWER_REG_BIT(reg);
+	if (dirty)
+		power_cache_dirty |= POWER_REG_BIT(reg);
+}
+
+/* must be called with power_cache_lock held */
+static u32 __power_readl(unsigned int reg)
+{
+	u32 owned = power_owned(reg);
+	u32 val = power_hw_readl(reg);
+
+	if (!(power_cache_valid & POWER_REG_BIT(reg))) {
+		__power_cache_store(reg, val, 0);
+		return val;
+	}
+	return (val & ~owned) | power_cache[reg / POWER_REG_STRIDE];
+}
+
+static u32 power_readl(unsigned int reg)
+{
+	unsigned long flags;
+	u32 val;
+
+	if (!power_owned(reg))
+		return power_hw_readl(reg);
+
+	spin_lock_irqsave(&power_cache_lock, flags);
+	val = __power_readl(reg);
+	spin_unlock_irqrestore(&power_cache_lock, flags);
+	return val;
+}
+
+/* the bits in mask, without going to the hardware if they are owned */
+static u32 power_read_bits(unsigned int reg, u32 mask)
+{
+	unsigned long flags;
+	u32 val;
+
+	if (mask & ~power_owned(reg))
+		return power_readl(reg) & mask;
+
+	spin_lock_irqsave(&power_cache_lock, flags);
+	if (power_cache_valid & POWER_REG_BIT(reg))
+		val = power_cache[reg / POWER_REG_STRIDE];
+	else
+		val = __power_readl(reg);
+	spin_unlock_irqrestore(&power_cache_lock, flags);
+	return val & mask;
+}
+
+static void power_writel(u32 val, unsigned int reg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&power_cache_lock, flags);
+	power_hw_writel(val, reg);
+	__power_cache_store(reg, val, 1);
+	spin_unlock_irqrestore(&power_cache_lock, flags);
+}
+
+/*
+ * Read-modify-write of the bits in mask. Registers with SET/CLR aliases
+ * are changed with at most two writes and no read, the others are only
+ * written when the value actually changes.
+ */
+static void power_update_bits(unsigned int reg, u32 mask, u32 val)
+{
+	unsigned long flags;
+	u32 old, new;
+
+	spin_lock_irqsave(&power_cache_lock, flags);
+	if (POWER_SCT_REGS & POWER_REG_BIT(reg)) {
+		if (val & mask)
+			power_hw_writel(val & mask, reg + SET_OFFSET);
+		if (~val & mask)
+			power_hw_writel(~val & mask, reg + CLR_OFFSET);
+	} else {
+		old = __power_readl(reg);
+		new = (old & ~mask) | (val & mask);
+		if (new != old)
+			power_hw_writel(new, reg);
+		if (mask & power_owned(reg))
+			__power_cache_store(reg, new, 1);
+	}
+	spin_unlock_irqrestore(&power_cache_lock, flags);
+}
+
+/*
+ * Put the owned fields the driver has set back into the hardware,
+ * the rest of each register is left as it is now.
+ */
+void mxs_power_regs_sync(void)
+{
+	unsigned long flags;
+	unsigned int reg;
+	u32 owned, hw, val;
+
+	spin_lock_irqsave(&power_cache_lock, flags);
+	for (reg = 0; reg < POWER_NUM_REGS * POWER_REG_STRIDE;
+	     reg += POWER_REG_STRIDE) {
+		owned = power_owned(reg);
+		if (!owned || !(power_cache_dirty & POWER_REG_BIT(reg)))
+			continue;
+		hw = power_hw_readl(reg);
+		val = (hw & ~owned) | power_cache[reg / POWER_REG_STRIDE];
+		if (val != hw)
+			power_hw_writel(val, reg);
+	}
+	spin_unlock_irqrestore(&power_cache_lock, flags);
+}
+EXPORT_SYMBOL_GPL(mxs_power_regs_sync);
+
+static int power_regs_show(struct seq_file *s, void *unused)
+{
+	unsigned int reg;
+	u32 bit;
+
+	for (reg = 0; reg < POWER_NUM_REGS * POWER_REG_STRIDE;
+	     reg += POWER_REG_STRIDE) {
+		bit = POWER_REG_BIT(reg);
+		if (POWER_HOLE_REGS & bit)
+			continue;
+		seq_printf(s, "%03x: %08x", reg, power_readl(reg));
+		if (power_owned(reg))
+			seq_printf(s, " owned %08x%s", power_owned(reg),
+				   power_cache_dirty & bit ? " dirty" : "");
+		seq_printf(s, "\n");
+	}
+	return 0;
+}
+
+static int power_regs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, power_regs_show, inode->i_private);
+}
+
+static const struct file_operations power_regs_fops = {
+	.open		= power_regs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct dentry *power_debugfs;
+
+/*
+ * Request trace: while trace_enable is set every state changing rail
+ * operation is logged into a ring of fixed size binary records, read
+ * back from debugfs mxs-power/trace and fed to mxs-power/replay.
+ */
+enum {
+	POWER_TRACE_SET_VOLTAGE,
+	POWER_TRACE_SET_CURRENT,
+	POWER_TRACE_ENABLE,
+	POWER_TRACE_DISABLE,
+	POWER_TRACE_SET_MODE,
+};
+
+struct power_trace_rec {
+	u64 ts_ns;		/* ktime at entry */
+	s32 min_val;		/* min_uV or min_uA, else val */
+	s32 val;		/* max uV, max uA or mode */
+	u32 dur_ns;
+	u16 rail;		/* mxs_regulator_rail id */
+	u8 op;
+	s8 ret;
+	u32 pid;
+	/* the core doesn't tell the driver the consumer, the task it is */
+	char comm[TASK_COMM_LEN];
+} __packed;
+
+/* 4096 records of 44 bytes, 176 KiB of vmalloc while tracing */
+#define POWER_TRACE_LEN	4096
+
+static struct power_trace_rec *trace_buf;
+static u32 trace_head;
+static u32 trace_enable;
+static DEFINE_SPINLOCK(trace_lock);
+
+static inline u64 power_trace_begin(void)
+{
+	return ACCESS_ONCE(trace_enable) ? power_now_ns() : 0;
+}
+
+static void power_trace_range(struct regulator_dev *rdev, int op,
+			      int min_val, int val, int ret, u64 t)
+{
+	struct power_trace_rec *rec;
+	unsigned long flags;
+	u64 now;
+
+	if (!t || !trace_buf)
+		return;
+
+	now = power_now_ns();
+	spin_lock_irqsave(&trace_lock, flags);
+	rec = &trace_buf[trace_head++ % POWER_TRACE_LEN];
+	rec->ts_ns = t;
+	rec->min_val = min_val;
+	rec->val = val;
+	rec->dur_ns = min_t(u64, now - rec->ts_ns, U32_MAX);
+	rec->rail = rdev_get_id(rdev);
+	rec->op = op;
+	rec->ret = clamp(ret, -128, 127);
+	rec->pid = current->pid;
+	strncpy(rec->comm, current->comm, sizeof(rec->comm));
+	spin_unlock_irqrestore(&trace_lock, flags);
+}
+
+static inline void power_trace_end(struct regulator_dev *rdev, int op,
+				   int val, int ret, u64 t)
+{
+	power_trace_range(rdev, op, val, val, ret, t);
+}
+
+struct power_trace_snap {
+	size_t len;
+	struct power_trace_rec rec[0];
+};
+
+/* snapshot the ring oldest first, so a slow reader sees a stable trace */
+static int power_trace_open(struct inode *inode, struct file *file)
+{
+	struct power_trace_snap *snap;
+	u32 first, n, i;
+
+	if (!trace_buf)
+		return -ENODEV;
+	if (!(file->f_mode & FMODE_READ))
+		return 0;
+
+	snap = vmalloc(sizeof(*snap) + POWER_TRACE_LEN * sizeof(*trace_buf));
+	if (!snap)
+		return -ENOMEM;
+
+	spin_lock_irq(&trace_lock);
+	n = min_t(u32, trace_head, POWER_TRACE_LEN);
+	first = trace_head - n;
+	for (i = 0; i < n; i++)
+		snap->rec[i] = trace_buf[(first + i) % POWER_TRACE_LEN];
+	spin_unlock_irq(&trace_lock);
+
+	snap->len = n * sizeof(*trace_buf);
+	file->private_data = snap;
+	return 0;
+}
+
+static ssize_t power_trace_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct power_trace_snap *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, snap->rec, snap->len);
+}
+
+/* any write empties the ring */
+static ssize_t power_trace_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	spin_lock_irq(&trace_lock);
+	trace_head = 0;
+	spin_unlock_irq(&trace_lock);
+	return count;
+}
+
+static int power_trace_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations power_trace_fops = {
+	.open		= power_trace_open,
+	.read		= power_trace_read,
+	.write		= power_trace_write,
+	.release	= power_trace_release,
+};
+
+/*
+ * The DC-DC rails learn how long DC_OK takes to come back per TRG step,
+ * set_voltage() sleeps through most of the predicted settle time and
+ * only polls near its end.
+ */
+struct mxs_dcdc_regulator {
+	struct mxs_regulator sreg;
+	u32 settle_ns_per_step;		/* EWMA, 0 until first measured */
+	u32 transitions;
+	u32 slept_us;
+	u32 polled_us;
+
+	/* stepped TRG ramp, see power_ramp_tick() */
+	struct hrtimer ramp_timer;
+	spinlock_t ramp_lock;
+	wait_queue_head_t ramp_wq;
+	u32 ramp_step;			/* TRG codes per step, 0 jumps
+					   as far as power_bo_room() */
+	u32 ramp_step_us;
+	u32 ramp_period_us;		/* ramp_step_us when the ramp began */
+	u32 ramp_stalled;		/* ticks without DC_OK */
+	int ramp_code;			/* last code written */
+	int ramp_settled;		/* last code DC_OK was seen at */
+	int ramp_target;
+	int ramping;
+	u32 ramps;
+	u32 ramp_aborts;
+
+	/* serialises TRG updates, base_code is what was last asked for */
+	struct mutex lock;
+	int base_code;
+	int bo_offs;			/* brownout margin, in BO_OFFSET steps */
+	int loadline_code;		/* added to base_code, vddd only */
+	int bo_bump;			/* added too, by brownout interrupts */
+	struct delayed_work bo_decay_work;
+	u32 loadline_updates;
+
+	/* deferred decreases, see __set_voltage() */
+	struct delayed_work down_work;
+	u32 down_delay_ms;		/* 0 applies them at once */
+	int down_min_uv;
+	int down_uv;
+	u32 down_deferred;
+	u32 down_applied;
+	u32 down_avoided;
+};
+
+#define to_dcdc(s) container_of(s, struct mxs_dcdc_regulator, sreg)
+
+#define POWER_SETTLE_MIN_SLEEP_US	30
+/* assumed until a rail has measured itself, generous on purpose */
+#define POWER_SETTLE_DEFAULT_NS_PER_STEP	50000
+
+static unsigned int power_settle_predict(struct mxs_dcdc_regulator *dcdc,
+					 int steps)
+{
+	unsigned int us = dcdc->settle_ns_per_step * steps / NSEC_PER_USEC;
+
+	/* leave a quarter of it to polling */
+	us -= us / 4;
+	return us < POWER_SETTLE_MIN_SLEEP_US ? 0 : us;
+}
+
+static void power_settle_learn(struct mxs_dcdc_regulator *dcdc, int steps,
+			       u64 ns)
+{
+	u32 per_step = min_t(u64, div_u64(ns, steps), U32_MAX);
+
+	if (!dcdc->settle_ns_per_step)
+		dcdc->settle_ns_per_step = per_step;
+	else
+		dcdc->settle_ns_per_step += ((s32)per_step -
+					     (s32)dcdc->settle_ns_per_step) / 4;
+}
+
+static inline unsigned int power_ctrl_reg(struct mxs_regulator *sreg)
+{
+	return sreg->rdata->control_reg - (u32)REGS_POWER_BASE;
+}
+
+static int power_code_to_uv(struct mxs_regulator *sreg, u32 val)
 {
-	int uv;
 	struct mxs_platform_regulator_data *rdata = sreg->rdata;
-	u32 val = __raw_readl(rdata->control_reg) & 0x1f;
+
+	if (rdata->control_reg == (u32)(REGS_POWER_BASE + HW_POWER_VDDIOCTRL))
+		return rdata->min_voltage + min_t(u32, val, 0x10) * 50000;
+	return rdata->min_voltage + val *
+		(rdata->max_voltage - rdata->min_voltage) / 0x1f;
+}
+
+static int get_voltage(struct mxs_regulator *sreg)
+{
+	u32 val = power_read_bits(power_ctrl_reg(sreg), 0x1f);
+	int uv = power_code_to_uv(sreg, val);
+
 	if (sreg->rdata->control_reg ==
-		(u32)(REGS_POWER_BASE + HW_POWER_VDDIOCTRL)) {
-		if (val > 0x10)
-			val = 0x10;
-		uv = rdata->min_voltage + val * 50000;
-		pr_info("vddio = %d, val=%u\n", uv, val);
-	} else
-		uv = rdata->min_voltage + val *
-		  (rdata->max_voltage - rdata->min_voltage) / 0x1f;
+		(u32)(REGS_POWER_BASE + HW_POWER_VDDIOCTRL))
+		pr_debug("vddio = %d, val=%u\n", uv, val);
 	return uv;
 }
 
-static int get_bo_voltage(struct mxs_regulator *sreg)
+/*
+ * The brownout level is BO_OFFSET steps of 25 mV below the vddd target.
+ * Both fields are owned by the driver, so they come from power_cache
+ * together, without a read of VDDDCTRL.
+ */
+static int get_bo_voltage(struct mxs_regulator *sreg)
+{
+	u32 reg;
+	int offs;
+
+	if (!sreg->parent)
+		return -EINVAL;
+
+	reg = power_read_bits(power_ctrl_reg(sreg->parent),
+			      POWER_TRG_BO_MASK);
+	offs = (reg & BM_POWER_VDDDCTRL_BO_OFFSET) >>
+		BP_POWER_VDDDCTRL_BO_OFFSET;
+	return power_code_to_uv(sreg->parent, reg & BM_POWER_VDDDCTRL_TRG) -
+		25000 * offs;
+}
+
+/* poll DC_OK for up to us microseconds, nonzero once it is set */
+static int power_wait_dc_ok(int us)
+{
+	for (; us; us--) {
+		if (power_readl(HW_POWER_STS) & BM_POWER_STS_DC_OK)
+			return us;
+		power_udelay(1);
+	}
+	return 0;
+}
+
+/*
+ * After a TRG write at t: sleep through the predicted settle time, then
+ * poll DC_OK, briefly and then for up to 40 ms. Nonzero if the rail
+ * settled, and the time it took to get there is learnt, so a rail
+ * slower than the short poll still gets its sleep predicted.
+ */
+static int power_dcdc_settle(struct mxs_dcdc_regulator *dcdc, int steps,
+			     u64 t)
+{
+	unsigned int sleep_us = steps ? power_settle_predict(dcdc, steps) : 0;
+	int left;
+
+	if (sleep_us) {
+		power_sleep_us(sleep_us);
+		dcdc->slept_us += sleep_us;
+	}
+
+	left = power_wait_dc_ok(20);
+	dcdc->polled_us += 20 - left;
+	if (!left) {
+		left = power_wait_dc_ok(40000);
+		dcdc->polled_us += 40000 - left;
+	}
+	if (left && steps)
+		power_settle_learn(dcdc, steps, power_now_ns() - t);
+	return left;
+}
+
+static int power_uv_to_code(struct mxs_regulator *sreg, int uv, int up)
+{
+	struct mxs_platform_regulator_data *rdata = sreg->rdata;
+	int span = uv - rdata->min_voltage;
+
+	if (rdata->control_reg == (u32)(REGS_POWER_BASE + HW_POWER_VDDIOCTRL))
+		return up ? DIV_ROUND_UP(span, 50000) : span / 50000;
+	if (up)
+		return DIV_ROUND_UP(span * 0x1f,
+				    rdata->max_voltage - rdata->min_voltage);
+	return span * 0x1f / (rdata->max_voltage - rdata->min_voltage);
+}
+
+/*
+ * BO_OFFSET to write along with a TRG change from old to code: the
+ * rail's margin, widened by the rise so the brownout level does not
+ * move up before the output has. One BO_OFFSET step is one TRG step
+ * on all three rails, and the field sits at the same place in each.
+ */
+static u32 power_bo_field(struct mxs_dcdc_regulator *dcdc, int old, int code)
+{
+	return BF_POWER_VDDDCTRL_BO_OFFSET(min(dcdc->bo_offs +
+					       max(code - old, 0), 7));
+}
+
+/*
+ * BO_OFFSET saturates at 7, so a rise of more than 7 - bo_offs codes in
+ * one write would lift the brownout level above the output. Such rises
+ * are ramped on every rail, in steps of at most this many codes.
+ */
+static int power_bo_room(struct mxs_dcdc_regulator *dcdc)
+{
+	return max(7 - dcdc->bo_offs, 1);
+}
+
+/* back to the plain margin, once a rise has settled; ramp_lock held */
+static void __power_bo_restore(struct mxs_dcdc_regulator *dcdc)
+{
+	power_update_bits(power_ctrl_reg(&dcdc->sreg),
+			  BM_POWER_VDDDCTRL_BO_OFFSET,
+			  BF_POWER_VDDDCTRL_BO_OFFSET(dcdc->bo_offs));
+}
+
+/* a running ramp restores the margin itself when it ends */
+static void power_bo_restore(struct mxs_dcdc_regulator *dcdc)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dcdc->ramp_lock, flags);
+	if (!dcdc->ramping)
+		__power_bo_restore(dcdc);
+	spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+}
+
+/*
+ * code plus the steps brownout interrupts took, which they take under
+ * ramp_lock; must be called with it held.
+ */
+static int power_bump_code(struct mxs_dcdc_regulator *dcdc, int code)
+{
+	struct mxs_regulator *sreg = &dcdc->sreg;
+
+	return min(code + dcdc->bo_bump,
+		   power_uv_to_code(sreg, sreg->rdata->max_voltage, 0));
+}
+
+/* must be called with ramp_lock held */
+static void power_ramp_step(struct mxs_dcdc_regulator *dcdc)
+{
+	int step = dcdc->ramp_step ?: 0x1f;
+	int next;
+
+	if (dcdc->ramp_target > dcdc->ramp_code)
+		next = min(dcdc->ramp_code + min(step, power_bo_room(dcdc)),
+			   dcdc->ramp_target);
+	else
+		next = max(dcdc->ramp_code - step, dcdc->ramp_target);
+
+	power_update_bits(power_ctrl_reg(&dcdc->sreg), POWER_TRG_BO_MASK,
+			  next | power_bo_field(dcdc, dcdc->ramp_code, next));
+	dcdc->ramp_code = next;
+}
+
+/* a ramp whose rail shows no DC_OK for this long is given up */
+#define POWER_RAMP_STALL_US	40000
+/* the tick of a ramp on a rail with no ramp_step_us of its own */
+#define POWER_RAMP_DEFAULT_STEP_US	50
+
+/*
+ * Every ramp_step_us: once DC_OK shows the last step has settled, write
+ * the next one, until the target is reached and has settled.
+ */
+static enum hrtimer_restart power_ramp_tick(struct hrtimer *timer)
+{
+	struct mxs_dcdc_regulator *dcdc =
+		container_of(timer, struct mxs_dcdc_regulator, ramp_timer);
+	enum hrtimer_restart ret = HRTIMER_RESTART;
+	unsigned long flags;
+
+#ifdef CONFIG_MXS_POWER_SIM
+	/* a tick is ramp_step_us of virtual time too */
+	mxs_power_sim_delay(dcdc->ramp_period_us);
+#endif
+
+	spin_lock_irqsave(&dcdc->ramp_lock, flags);
+	if (!dcdc->ramping) {
+		/* given up by power_ramp() */
+		ret = HRTIMER_NORESTART;
+	} else if (power_readl(HW_POWER_STS) & BM_POWER_STS_DC_OK) {
+		dcdc->ramp_stalled = 0;
+		dcdc->ramp_settled = dcdc->ramp_code;
+		if (dcdc->ramp_code == dcdc->ramp_target) {
+			__power_bo_restore(dcdc);
+			dcdc->ramping = 0;
+			ret = HRTIMER_NORESTART;
+		} else
+			power_ramp_step(dcdc);
+	} else if (++dcdc->ramp_stalled * dcdc->ramp_period_us >=
+		   POWER_RAMP_STALL_US) {
+		/* keep the widened BO_OFFSET, the rail is not there yet */
+		dcdc->ramping = 0;
+		dcdc->ramp_aborts++;
+		ret = HRTIMER_NORESTART;
+	}
+	spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+
+	wake_up_all(&dcdc->ramp_wq);
+	if (ret == HRTIMER_RESTART)
+		hrtimer_forward_now(timer,
+				    ns_to_ktime((u64)dcdc->ramp_period_us *
+						NSEC_PER_USEC));
+	return ret;
+}
+
+/*
+ * Ramp to code in the background. Going up the caller waits until the
+ * rail has settled at safe or above, going down it does not wait.
+ */
+static int power_ramp(struct mxs_dcdc_regulator *dcdc, int code, int safe)
+{
+	unsigned long flags, timeout;
+	int start, steps;
+
+	spin_lock_irqsave(&dcdc->ramp_lock, flags);
+	code = power_bump_code(dcdc, code);
+	start = !dcdc->ramping;
+	if (start) {
+		dcdc->ramp_code = power_read_bits(power_ctrl_reg(&dcdc->sreg),
+						  0x1f);
+		dcdc->ramp_settled = dcdc->ramp_code;
+		dcdc->ramp_period_us = dcdc->ramp_step_us ?:
+				       POWER_RAMP_DEFAULT_STEP_US;
+		dcdc->ramp_stalled = 0;
+	}
+	steps = abs(code - dcdc->ramp_code);
+	dcdc->ramp_target = code;
+	if (code != dcdc->ramp_code) {
+		dcdc->ramping = 1;
+		if (start)
+			power_ramp_step(dcdc);
+	} else
+		start = 0;
+	spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+
+	if (start) {
+		dcdc->ramps++;
+		hrtimer_start(&dcdc->ramp_timer,
+			      ns_to_ktime((u64)dcdc->ramp_period_us *
+					  NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	}
+
+	if (code < safe)
+		safe = code;
+	timeout = usecs_to_jiffies((steps / max_t(u32, dcdc->ramp_step, 1)
+				    + 1) * dcdc->ramp_period_us * 4) +
+		  msecs_to_jiffies(40);
+	if (!wait_event_timeout(dcdc->ramp_wq,
+				ACCESS_ONCE(dcdc->ramp_settled) >= safe ||
+				!ACCESS_ONCE(dcdc->ramping), timeout)) {
+		/* out of time, stop stepping rather than run on forever */
+		hrtimer_cancel(&dcdc->ramp_timer);
+		spin_lock_irqsave(&dcdc->ramp_lock, flags);
+		if (dcdc->ramping) {
+			dcdc->ramping = 0;
+			dcdc->ramp_aborts++;
+		}
+		spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+		wake_up_all(&dcdc->ramp_wq);
+	}
+
+	return ACCESS_ONCE(dcdc->ramp_settled) < safe;
+}
+
+static int power_loadline_code(struct mxs_dcdc_regulator *dcdc, int code)
+{
+	struct mxs_regulator *sreg = &dcdc->sreg;
+
+	return min(code + dcdc->loadline_code,
+		   power_uv_to_code(sreg, sreg->rdata->max_voltage, 0));
+}
+
+/*
+ * Must be called with dcdc->lock held. val is the code without the
+ * brownout bump, which is added under ramp_lock along with the read
+ * and the write, so a step the interrupt takes meanwhile is kept.
+ */
+static int power_dcdc_write(struct mxs_dcdc_regulator *dcdc, u32 val,
+			    int safe)
+{
+	struct mxs_regulator *sreg = &dcdc->sreg;
+	unsigned long flags;
+	u32 reg;
+	int code, old, steps, left, ramp;
+	u64 t = 0;
+
+	spin_lock_irqsave(&dcdc->ramp_lock, flags);
+	reg = power_readl(power_ctrl_reg(sreg));
+	old = reg & 0x1f;
+	code = power_bump_code(dcdc, val);
+	steps = abs(code - old);
+
+	/*
+	 * Large changes, rises BO_OFFSET cannot cover and any change while
+	 * a ramp runs are stepped.
+	 */
+	ramp = (dcdc->ramp_step && dcdc->ramp_step_us &&
+		steps > dcdc->ramp_step) ||
+	       code - old > power_bo_room(dcdc) || dcdc->ramping;
+	if (!ramp) {
+		reg = (reg & ~POWER_TRG_BO_MASK) | code |
+		      power_bo_field(dcdc, old, code);
+		t = power_now_ns();
+		power_writel(reg, power_ctrl_reg(sreg));
+	}
+	spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+	pr_debug("%s: calculated val %d\n", __func__, code);
+
+	if (ramp)
+		return power_ramp(dcdc, val, safe);
+
+	dcdc->transitions++;
+	left = power_dcdc_settle(dcdc, steps, t);
+
+	/* write it once more, as it is now, and give it another 40 ms */
+	if (!left) {
+		spin_lock_irqsave(&dcdc->ramp_lock, flags);
+		power_writel(power_readl(power_ctrl_reg(sreg)),
+			     power_ctrl_reg(sreg));
+		spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+		left = power_wait_dc_ok(40000);
+		dcdc->polled_us += 40000 - left;
+	}
+
+	if (left && code > old)
+		power_bo_restore(dcdc);
+	return !left;
+}
+
+static int power_dcdc_apply(struct mxs_regulator *sreg, int min_uv, int uv)
+{
+	struct mxs_dcdc_regulator *dcdc = to_dcdc(sreg);
+	int ret;
+
+	mutex_lock(&dcdc->lock);
+	dcdc->base_code = power_uv_to_code(sreg, uv, 0);
+	ret = power_dcdc_write(dcdc, power_loadline_code(dcdc, dcdc->base_code),
+			       power_uv_to_code(sreg, max(min_uv,
+					sreg->rdata->min_voltage), 1));
+	mutex_unlock(&dcdc->lock);
+
+	return ret;
+}
+
+static void power_dcdc_down_work(struct work_struct *work)
+{
+	struct mxs_dcdc_regulator *dcdc = container_of(to_delayed_work(work),
+				struct mxs_dcdc_regulator, down_work);
+
+	if (!power_dcdc_apply(&dcdc->sreg, dcdc->down_min_uv, dcdc->down_uv))
+		dcdc->down_applied++;
+}
+
+static void power_dcdc_init(struct mxs_dcdc_regulator *dcdc)
+{
+	spin_lock_init(&dcdc->ramp_lock);
+	init_waitqueue_head(&dcdc->ramp_wq);
+	hrtimer_init(&dcdc->ramp_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dcdc->ramp_timer.function = power_ramp_tick;
+	INIT_DELAYED_WORK(&dcdc->down_work, power_dcdc_down_work);
+	mutex_init(&dcdc->lock);
+	dcdc->base_code = power_read_bits(power_ctrl_reg(&dcdc->sreg), 0x1f);
+	dcdc->bo_offs = power_read_bits(power_ctrl_reg(&dcdc->sreg),
+					BM_POWER_VDDDCTRL_BO_OFFSET) >>
+			BP_POWER_VDDDCTRL_BO_OFFSET;
+}
+
+/* the code the rail is at, or is ramping to */
+static int power_dcdc_code(struct mxs_dcdc_regulator *dcdc)
+{
+	if (ACCESS_ONCE(dcdc->ramping))
+		return ACCESS_ONCE(dcdc->ramp_target);
+	return power_read_bits(power_ctrl_reg(&dcdc->sreg), 0x1f);
+}
+
+/*
+ * With down_delay_ms set a decrease only takes effect once no other
+ * request came for that long, an increase cancels it and applies at
+ * once. A bursty governor then keeps the rail up instead of paying for
+ * two transitions per burst. It is off by default: it trades the power
+ * of holding the higher level for a while against the transitions, so
+ * boards opt in through debugfs.
+ */
+static int __set_voltage(struct mxs_regulator *sreg, int min_uv, int uv)
+{
+	struct mxs_dcdc_regulator *dcdc = to_dcdc(sreg);
+	int pending, down;
+
+	pr_debug("%s: uv %d, min %d, max %d\n", __func__,
+		uv, sreg->rdata->min_voltage, sreg->rdata->max_voltage);
+
+	if (uv < sreg->rdata->min_voltage || uv > sreg->rdata->max_voltage)
+		return -EINVAL;
+
+	pending = cancel_delayed_work_sync(&dcdc->down_work);
+	down = power_loadline_code(dcdc, power_uv_to_code(sreg, uv, 0)) +
+	       ACCESS_ONCE(dcdc->bo_bump) < power_dcdc_code(dcdc);
+
+	/* a decrease replacing a decrease was only postponed */
+	if (pending && !down)
+		dcdc->down_avoided++;
+
+	if (dcdc->down_delay_ms && down) {
+		dcdc->down_min_uv = min_uv;
+		dcdc->down_uv = uv;
+		dcdc->down_deferred++;
+		schedule_delayed_work(&dcdc->down_work,
+				      msecs_to_jiffies(dcdc->down_delay_ms));
+		return 0;
+	}
+
+	return power_dcdc_apply(sreg, min_uv, uv);
+}
+
+static int set_voltage(struct mxs_regulator *sreg, int uv)
+{
+	return __set_voltage(sreg, uv, uv);
+}
+
+/*
+ * The brownout level is kept as a margin below vddd, which every vddd
+ * change writes along with TRG. Changing the margin does not move the
+ * rail, so there is nothing to wait for.
+ */
+static int set_bo_voltage(struct mxs_regulator *sreg, int bo_uv)
+{
+	struct mxs_dcdc_regulator *dcdc;
+	int uv;
+	int offs;
+
+	if (!sreg->parent)
+		return -EINVAL;
+
+	dcdc = to_dcdc(sreg->parent);
+	mutex_lock(&dcdc->lock);
+	uv = get_voltage(sreg->parent);
+	offs = (uv - bo_uv) / 25000;
+	if (offs < 0 || offs > 7) {
+		mutex_unlock(&dcdc->lock);
+		return -EINVAL;
+	}
+
+	pr_debug("%s: calculated offs %d\n", __func__, offs);
+	dcdc->bo_offs = offs;
+	power_bo_restore(dcdc);
+	mutex_unlock(&dcdc->lock);
+
+	return 0;
+}
+
+static int enable(struct mxs_regulator *sreg)
+{
+	/* XXX: TODO */
+	return 0;
+}
+
+static int disable(struct mxs_regulator *sreg)
+{
+	/* XXX: TODO */
+	return 0;
+}
+
+static int is_enabled(struct mxs_regulator *sreg)
+{
+	/* XXX: TODO */
+	return 1;
+}
+
+static int set_mode(struct mxs_regulator *sreg, int mode)
+{
+	int ret = 0;
+
+	switch (mode) {
+	case REGULATOR_MODE_FAST:
+		power_update_bits(power_ctrl_reg(sreg), 1 << 17, 1 << 17);
+		break;
+
+	case REGULATOR_MODE_NORMAL:
+		power_update_bits(power_ctrl_reg(sreg), 1 << 17, 0);
+		break;
+
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	return ret;
+}
+
+static int get_mode(struct mxs_regulator *sreg)
+{
+	u32 val = power_readl(power_ctrl_reg(sreg)) & (1 << 17);
+
+	return val ? REGULATOR_MODE_FAST : REGULATOR_MODE_NORMAL;
+}
+
+/*
+ * regulator_ops for the DC-DC rails and the brownout pseudo-rail, they
+ * call the helpers above directly instead of going through rdata.
+ */
+static int dcdc_set_voltage(struct regulator_dev *rdev, int min_uV, int uV)
+{
+	u64 t = power_trace_begin();
+	int ret = __set_voltage(rdev_get_drvdata(rdev), min_uV, uV);
+
+	power_trace_range(rdev, POWER_TRACE_SET_VOLTAGE, min_uV, uV, ret, t);
+	return ret;
+}
+
+static int dcdc_get_voltage(struct regulator_dev *rdev)
+{
+	return get_voltage(rdev_get_drvdata(rdev));
+}
+
+static int dcdc_is_enabled(struct regulator_dev *rdev)
+{
+	return is_enabled(rdev_get_drvdata(rdev));
+}
+
+static int dcdc_set_mode(struct regulator_dev *rdev, unsigned int mode)
+{
+	u64 t = power_trace_begin();
+	int ret = set_mode(rdev_get_drvdata(rdev), mode);
+
+	power_trace_end(rdev, POWER_TRACE_SET_MODE, mode, ret, t);
+	return ret;
+}
+
+static unsigned int dcdc_get_mode(struct regulator_dev *rdev)
+{
+	return get_mode(rdev_get_drvdata(rdev));
+}
+
+static struct regulator_ops dcdc_rops = {
+	.set_voltage	= dcdc_set_voltage,
+	.get_voltage	= dcdc_get_voltage,
+	.is_enabled	= dcdc_is_enabled,
+	.set_mode	= dcdc_set_mode,
+	.get_mode	= dcdc_get_mode,
+};
+
+static int bo_set_voltage(struct regulator_dev *rdev, int min_uV, int uV)
+{
+	u64 t = power_trace_begin();
+	int ret = set_bo_voltage(rdev_get_drvdata(rdev), uV);
+
+	power_trace_range(rdev, POWER_TRACE_SET_VOLTAGE, min_uV, uV, ret, t);
+	return ret;
+}
+
+static int bo_get_voltage(struct regulator_dev *rdev)
+{
+	return get_bo_voltage(rdev_get_drvdata(rdev));
+}
+
+static struct regulator_ops bo_rops = {
+	.set_voltage	= bo_set_voltage,
+	.get_voltage	= bo_get_voltage,
+	.is_enabled	= dcdc_is_enabled,
+};
+
+static struct mxs_platform_regulator_data vddd_data = {
+	.name		= "vddd",
+	.set_voltage	= set_voltage,
+	.get_voltage	= get_voltage,
+	.enable		= enable,
+	.disable	= disable,
+	.is_enabled	= is_enabled,
+	.set_mode	= set_mode,
+	.get_mode	= get_mode,
+	.control_reg	= (u32)(REGS_POWER_BASE + HW_POWER_VDDDCTRL),
+	.min_voltage	= 800000,
+	.max_voltage	= 1575000,
+};
+
+static struct mxs_platform_regulator_data vdddbo_data = {
+	.name		= "vddd_bo",
+	.parent_name	= "vddd",
+	.set_voltage	= set_bo_voltage,
+	.get_voltage	= get_bo_voltage,
+	.enable		= enable,
+	.disable	= disable,
+	.is_enabled	= is_enabled,
+	.set_mode	= set_mode,
+	.get_mode	= get_mode,
+	.min_voltage	= 800000,
+	.max_voltage	= 1575000,
+};
+
+static struct mxs_platform_regulator_data vdda_data = {
+	.name		= "vdda",
+	.set_voltage	= set_voltage,
+	.get_voltage	= get_voltage,
+	.enable		= enable,
+	.disable	= disable,
+	.is_enabled	= is_enabled,
+	.set_mode	= set_mode,
+	.get_mode	= get_mode,
+	.control_reg	= (u32)(REGS_POWER_BASE + HW_POWER_VDDACTRL),
+	.min_voltage	= 1500000,
+	.max_voltage	= 2275000,
+};
+
+#define MX28EVK_VDDIO_OFFSET 80000
+static struct mxs_platform_regulator_data vddio_data = {
+	.name		= "vddio",
+	.set_voltage	= set_voltage,
+	.get_voltage	= get_voltage,
+	.enable		= enable,
+	.disable	= disable,
+	.is_enabled	= is_enabled,
+	.set_mode	= set_mode,
+	.get_mode	= get_mode,
+	.control_reg	= (u32)(REGS_POWER_BASE + HW_POWER_VDDIOCTRL),
+	.min_voltage	= 2800000 + MX28EVK_VDDIO_OFFSET,
+	.max_voltage	= 3600000 + MX28EVK_VDDIO_OFFSET,
+};
+
+static struct regulator_consumer_supply vddd_supply = {
+	.supply		= "vddd",
+};
+
+static struct regulator_init_data vddd_init = {
+	.consumer_supplies	= &vddd_supply,
+	.num_consumer_supplies	= 1,
+	.constraints = {
+		.name			= "vddd",
+		.min_uV			= 800000,
+		.max_uV			= 1575000,
+		.valid_modes_mask	= REGULATOR_MODE_FAST |
+					  REGULATOR_MODE_NORMAL,
+		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
+					  REGULATOR_CHANGE_MODE,
+		.input_uV		= 5000000,
+		.always_on		= 1,
+	}
+};
+
+static struct regulator_consumer_supply vdddbo_supply = {
+	.supply		= "vddd_bo",
+};
+
+static struct regulator_init_data vdddbo_init = {
+	.consumer_supplies	= &vdddbo_supply,
+	.num_consumer_supplies	= 1,
+	.constraints = {
+		.name			= "vdddbo",
+		.min_uV			= 800000,
+		.max_uV			= 1575000,
+		.valid_modes_mask	= REGULATOR_MODE_FAST |
+					  REGULATOR_MODE_NORMAL,
+		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
+					  REGULATOR_CHANGE_MODE,
+		.input_uV		= 5000000,
+		.always_on		= 1,
+	}
+};
+
+
+static struct regulator_consumer_supply vdda_supply = {
+	.supply		= "vdda",
+};
+
+static struct regulator_init_data vdda_init = {
+	.consumer_supplies	= &vdda_supply,
+	.num_consumer_supplies	= 1,
+	.constraints = {
+		.name			= "vdda",
+		.min_uV			= 1500000,
+		.max_uV			= 2275000,
+		.valid_modes_mask	= REGULATOR_MODE_FAST |
+					  REGULATOR_MODE_NORMAL,
+		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
+					  REGULATOR_CHANGE_MODE,
+		.input_uV		= 5000000,
+		.always_on		= 1,
+	}
+};
+
+
+static struct regulator_consumer_supply vddio_supply = {
+	.supply		= "vddio",
+};
+
+static struct regulator_init_data vddio_init = {
+	.consumer_supplies	= &vddio_supply,
+	.num_consumer_supplies	= 1,
+	.constraints = {
+		.name			= "vddio",
+		.min_uV			= 2800000 + MX28EVK_VDDIO_OFFSET,
+		.max_uV			= 3600000 + MX28EVK_VDDIO_OFFSET,
+		.valid_modes_mask	= REGULATOR_MODE_FAST |
+					  REGULATOR_MODE_NORMAL,
+		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
+					  REGULATOR_CHANGE_MODE,
+		.input_uV		= 5000000,
+		.always_on		= 1,
+	}
+};
+
+static int vbus5v_enable(struct mxs_regulator *sreg)
+{
+	gpio_set_value(USB_POWER_ENABLE, 1);
+	return 0;
+}
+
+static int vbus5v_disable(struct mxs_regulator *sreg)
+{
+	gpio_set_value(USB_POWER_ENABLE, 0);
+	return 0;
+}
+
+static int vbus5v_is_enabled(struct mxs_regulator *sreg)
+{
+	return gpio_get_value(USB_POWER_ENABLE);
+}
+
+
+static int vbus5v_rop_enable(struct regulator_dev *rdev)
+{
+	u64 t = power_trace_begin();
+	int ret = vbus5v_enable(rdev_get_drvdata(rdev));
+
+	power_trace_end(rdev, POWER_TRACE_ENABLE, 1, ret, t);
+	return ret;
+}
+
+static int vbus5v_rop_disable(struct regulator_dev *rdev)
+{
+	u64 t = power_trace_begin();
+	int ret = vbus5v_disable(rdev_get_drvdata(rdev));
+
+	power_trace_end(rdev, POWER_TRACE_DISABLE, 0, ret, t);
+	return ret;
+}
+
+static int vbus5v_rop_is_enabled(struct regulator_dev *rdev)
+{
+	return vbus5v_is_enabled(rdev_get_drvdata(rdev));
+}
+
+static struct regulator_ops vbus5v_rops = {
+	.enable		= vbus5v_rop_enable,
+	.disable	= vbus5v_rop_disable,
+	.is_enabled	= vbus5v_rop_is_enabled,
+};
+
+static struct mxs_platform_regulator_data vbus5v_data = {
+	.name		= "vbus5v",
+	.enable		= vbus5v_enable,
+	.disable	= vbus5v_disable,
+	.is_enabled	= vbus5v_is_enabled,
+};
+
+static struct regulator_consumer_supply vbus5v_supply = {
+	.supply		= "vbus5v",
+};
+
+static struct regulator_init_data vbus5v_init = {
+	.consumer_supplies	= &vbus5v_supply,
+	.num_consumer_supplies	= 1,
+	.constraints = {
+		.name			= "vbus5v",
+		.valid_ops_mask		= REGULATOR_CHANGE_STATUS,
+	}
+};
+
+
+/* now the current regulators */
+/* Restriction: .... no set_current call on root regulator */
+struct mxs_sibling_regulator {
+	struct mxs_regulator sreg;
+	struct mxs_platform_regulator_data rdata;
+	struct regulator_init_data init;
+
+	/*
+	 * Coalescing: decreases are only given back to the parent after
+	 * coalesce_ms without a new increase, req_current is what the
+	 * consumer asked for while sreg.cur_current is what is charged.
+	 */
+	unsigned int coalesce_ms;
+	int req_current;
+	struct delayed_work release_work;
+
+	/*
+	 * A disabled sibling holds no budget. Siblings are always on
+	 * unless the consumer opts in with mxs_platform_set_current_pm(),
+	 * it then disables it from its runtime_suspend and enables it
+	 * from runtime_resume, where req_current is charged again, from
+	 * acquire_work if the budget is not available right away.
+	 * enabled and acquiring are protected by sreg.lock.
+	 */
+	int enabled;
+	int acquiring;
+	struct work_struct acquire_work;
+
+	/* told to shed its load on a VDD5V droop, see power_droop_notify() */
+	int shed;
+
+	/* regulator_get(dev, name) finds it under its own name */
+	struct regulator_consumer_supply supply;
+
+	struct mxs_regulator_rail rail;
+};
+
+/* all siblings of one mxs_platform_add_regulator() call, one allocation */
+struct mxs_sibling_group {
+	struct list_head node;
+	int count;
+	struct mxs_sibling_regulator sib[0];
+};
+
+#define to_sibling(s) container_of(s, struct mxs_sibling_regulator, sreg)
+
+static LIST_HEAD(sibling_groups);
+static DEFINE_MUTEX(sibling_list_lock);
+
+static struct mxs_regulator overall_cur_reg;
+
+/* load-line compensation of vddd, see power_loadline_update() */
+static u32 power_loadline_uv_per_ma;
+static u32 power_loadline_max_uv = 100000;
+static void power_loadline_update(struct work_struct *work);
+static DECLARE_WORK(power_loadline_work, power_loadline_update);
+
+/*
+ * Emergency cap on overall_current, on top of max_current which
+ * reg_callback() owns. Set by power_budget_clamp(), lifted by
+ * power_budget_work once the holds of all causes have run out.
+ */
+enum {
+	POWER_HOLD_BROWNOUT,
+	POWER_HOLD_DROOP,
+	POWER_HOLD_CAUSES,
+};
+
+/* a droop that outlasts this many debounces no longer holds the cap */
+#define POWER_DROOP_RETRIES	10
+
+static int power_budget_limit = INT_MAX;
+static u32 power_budget_clamps;
+static u32 power_droop_debounce_ms = 500;
+static int power_droop_armed;
+static int power_droop_retries;
+static unsigned long power_hold_until[POWER_HOLD_CAUSES];	/* jiffies */
+static unsigned long power_hold_mask;
+static DEFINE_SPINLOCK(power_hold_lock);
+static void power_budget_restore(struct work_struct *work);
+static DECLARE_DELAYED_WORK(power_budget_work, power_budget_restore);
+
+static int main_max_current(struct mxs_regulator *sreg)
+{
+	if (sreg == &overall_cur_reg)
+		return min(sreg->rdata->max_current,
+			   ACCESS_ONCE(power_budget_limit));
+	return sreg->rdata->max_current;
+}
+
+static int main_add_current(struct mxs_regulator *sreg,
+			    int uA)
+{
+
+	pr_debug("%s: enter reg %s, uA=%d\n",
+		 __func__, sreg->regulator.name, uA);
+	if (uA > 0 && (sreg->cur_current + uA > main_max_current(sreg)))
+		return -EINVAL;
+	else
+		sreg->cur_current += uA;
+
+	if (sreg == &overall_cur_reg && uA &&
+	    ACCESS_ONCE(power_loadline_uv_per_ma))
+		schedule_work(&power_loadline_work);
+	return 0;
+}
+
+static int cur_reg_fits(struct mxs_regulator *sreg, int uA)
+{
+	return uA - sreg->cur_current <
+		main_max_current(sreg->parent) - sreg->parent->cur_current;
+}
+
+/* cap overall_current at uA, safe from hard irq context */
+static void power_budget_clamp(int uA)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&overall_cur_reg.lock, flags);
+	if (uA < power_budget_limit) {
+		power_budget_limit = uA;
+		power_budget_clamps++;
+	}
+	spin_unlock_irqrestore(&overall_cur_reg.lock, flags);
+}
+
+/* the latest deadline of the causes still held, 0 if none is */
+static unsigned long power_hold_latest(void)
+{
+	unsigned long latest = 0;
+	int i;
+
+	for (i = 0; i < POWER_HOLD_CAUSES; i++)
+		if ((power_hold_mask & (1 << i)) &&
+		    (!latest || time_after(power_hold_until[i], latest)))
+			latest = power_hold_until[i];
+	return latest;
+}
+
+/*
+ * (Re)arm the end of the cap for cause, ms from now. Each cause keeps
+ * its own deadline, the cap is lifted at the later one.
+ */
+static void power_budget_hold(int cause, unsigned int ms)
+{
+	unsigned long flags, latest;
+
+	spin_lock_irqsave(&power_hold_lock, flags);
+	power_hold_until[cause] = jiffies + msecs_to_jiffies(ms);
+	power_hold_mask |= 1 << cause;
+	latest = power_hold_latest();
+	spin_unlock_irqrestore(&power_hold_lock, flags);
+
+	cancel_delayed_work_sync(&power_budget_work);
+	schedule_delayed_work(&power_budget_work,
+			      time_after(latest, jiffies) ? latest - jiffies : 0);
+}
+
+/* listen for droops again, only while 5 V is there and not sagging */
+static void power_droop_rearm(void)
+{
+	u32 sts = power_readl(HW_POWER_STS);
+
+	if (!power_droop_armed || !(sts & BM_POWER_STS_VDD5V_GT_VDDIO) ||
+	    (sts & BM_POWER_STS_VDD5V_DROOP))
+		return;
+	power_update_bits(HW_POWER_CTRL, BM_POWER_CTRL_VDD5V_DROOP_IRQ, 0);
+	power_update_bits(HW_POWER_CTRL, BM_POWER_CTRL_ENIRQ_VDD5V_DROOP,
+			  BM_POWER_CTRL_ENIRQ_VDD5V_DROOP);
+}
+
+/*
+ * A droop still showing is debounced again, but only while 5 V is
+ * present, STS.VDD5V_DROOP stays set without it, and at most
+ * POWER_DROOP_RETRIES times. The interrupt then stays masked until
+ * 5 V comes back, see power_droop_5v().
+ */
+static void power_budget_restore(struct work_struct *work)
+{
+	u32 sts = power_readl(HW_POWER_STS);
+	unsigned long flags, latest;
+
+	spin_lock_irqsave(&power_hold_lock, flags);
+	if ((power_hold_mask & (1 << POWER_HOLD_DROOP)) &&
+	    !time_after(power_hold_until[POWER_HOLD_DROOP], jiffies)) {
+		if ((sts & BM_POWER_STS_VDD5V_DROOP) &&
+		    (sts & BM_POWER_STS_VDD5V_GT_VDDIO) &&
+		    power_droop_retries < POWER_DROOP_RETRIES) {
+			power_droop_retries++;
+			power_hold_until[POWER_HOLD_DROOP] = jiffies +
+				msecs_to_jiffies(power_droop_debounce_ms);
+		} else
+			power_hold_mask &= ~(1 << POWER_HOLD_DROOP);
+	}
+	if ((power_hold_mask & (1 << POWER_HOLD_BROWNOUT)) &&
+	    !time_after(power_hold_until[POWER_HOLD_BROWNOUT], jiffies))
+		power_hold_mask &= ~(1 << POWER_HOLD_BROWNOUT);
+	latest = power_hold_latest();
+	spin_unlock_irqrestore(&power_hold_lock, flags);
+
+	/* another cause is held longer */
+	if (latest) {
+		schedule_delayed_work(&power_budget_work,
+				      time_after(latest, jiffies) ?
+				      latest - jiffies : 0);
+		return;
+	}
+
+	spin_lock_irqsave(&overall_cur_reg.lock, flags);
+	power_budget_limit = INT_MAX;
+	spin_unlock_irqrestore(&overall_cur_reg.lock, flags);
+	wake_up_all(&overall_cur_reg.wait_q);
+
+	power_droop_rearm();
+}
+
+static u32 power_droop_events;
+
+/*
+ * VDD5V droop: the 5 V input is sagging, typically a USB host that
+ * cannot deliver what was granted. Nothing more is granted from here
+ * on, the thread then lowers the cap by what the shed siblings hold
+ * and tells them through their notifier chain. The interrupt stays
+ * masked until the budget is restored, power_droop_debounce_ms after
+ * the last droop, or until 5 V comes back.
+ */
+static irqreturn_t power_droop_irq(int irq, void *dev_id)
+{
+	if (!(power_readl(HW_POWER_CTRL) & BM_POWER_CTRL_VDD5V_DROOP_IRQ))
+		return IRQ_NONE;
+	power_update_bits(HW_POWER_CTRL, BM_POWER_CTRL_VDD5V_DROOP_IRQ |
+			  BM_POWER_CTRL_ENIRQ_VDD5V_DROOP, 0);
+
+	power_budget_clamp(max(ACCESS_ONCE(overall_cur_reg.cur_current), 0));
+	power_droop_events++;
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * The shed siblings are told from a work item, not the interrupt
+ * thread, and without their rdev->mutex: the typical reaction is to
+ * lower the limit or disable the sibling through the regulator API,
+ * which takes that mutex. The core's lock only guards passing the event
+ * on to supplied regulators, and siblings supply none. The rdevs are
+ * collected under sibling_list_lock with a reference each, and told
+ * after it is dropped.
+ */
+static void power_droop_notify(struct work_struct *work)
+{
+	struct mxs_sibling_group *group;
+	struct mxs_sibling_regulator *sib;
+	struct regulator_dev **rdevs;
+	int i, n = 0, num = 0;
+
+	mutex_lock(&sibling_list_lock);
+	list_for_each_entry(group, &sibling_groups, node)
+		num += group->count;
+	rdevs = kcalloc(num, sizeof(*rdevs), GFP_KERNEL);
+	list_for_each_entry(group, &sibling_groups, node)
+		for (i = 0; rdevs && i < group->count; i++) {
+			sib = &group->sib[i];
+			if (!sib->shed || !sib->rail.rdev)
+				continue;
+			get_device(&sib->rail.rdev->dev);
+			rdevs[n++] = sib->rail.rdev;
+		}
+	mutex_unlock(&sibling_list_lock);
+
+	for (i = 0; i < n; i++) {
+		regulator_notifier_call_chain(rdevs[i],
+				REGULATOR_EVENT_OVER_CURRENT, NULL);
+		put_device(&rdevs[i]->dev);
+	}
+	kfree(rdevs);
+}
+
+static DECLARE_WORK(power_droop_notify_work, power_droop_notify);
+
+static irqreturn_t power_droop_thread(int irq, void *dev_id)
+{
+	struct mxs_sibling_group *group;
+	struct mxs_sibling_regulator *sib;
+	int i, shed = 0;
+
+	mutex_lock(&sibling_list_lock);
+	list_for_each_entry(group, &sibling_groups, node)
+		for (i = 0; i < group->count; i++) {
+			sib = &group->sib[i];
+			if (sib->shed && sib->rail.rdev)
+				shed += ACCESS_ONCE(sib->sreg.cur_current);
+		}
+	mutex_unlock(&sibling_list_lock);
+	schedule_work(&power_droop_notify_work);
+
+	power_budget_clamp(max(ACCESS_ONCE(overall_cur_reg.cur_current) -
+			       shed, 0));
+	power_droop_retries = 0;
+	power_budget_hold(POWER_HOLD_DROOP, power_droop_debounce_ms);
+	if (printk_ratelimit())
+		pr_warning("vdd5v droop, budget capped at %d uA\n",
+			   ACCESS_ONCE(power_budget_limit));
+	return IRQ_HANDLED;
+}
+
+static void power_droop_init(void)
+{
+	int ret;
+
+	ret = request_threaded_irq(IRQ_VDD5V_DROOP, power_droop_irq,
+				   power_droop_thread, 0, "vdd5v-droop", NULL);
+	if (ret) {
+		pr_err("vdd5v droop irq: %d\n", ret);
+		return;
+	}
+	power_droop_armed = 1;
+	power_droop_rearm();
+}
+
+/*
+ * 5 V source events arrive on overall_current's chain. With nothing
+ * held the interrupt is rearmed now, otherwise power_budget_restore()
+ * does it when the hold ends.
+ */
+static int power_droop_5v(struct notifier_block *nb, unsigned long event,
+			  void *data)
+{
+	unsigned long flags, held;
+
+	if (event != MXS_REG5V_IS_USB && event != MXS_REG5V_NOT_USB)
+		return NOTIFY_DONE;
+
+	spin_lock_irqsave(&power_hold_lock, flags);
+	held = power_hold_mask;
+	spin_unlock_irqrestore(&power_hold_lock, flags);
+	if (!held)
+		power_droop_rearm();
+	return NOTIFY_OK;
+}
+
+static struct notifier_block power_droop_nb = {
+	.notifier_call = power_droop_5v,
+};
+
+/*
+ * Charge uA to the parent without waiting, releases never fail.
+ * Called with sreg->lock held, which serialises the consumer's own
+ * calls with release_work and acquire_work.
+ */
+static int cur_reg_try_charge(struct mxs_regulator *sreg, int uA)
+{
+	int ret;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sreg->parent->lock, flags);
+	ret = main_add_current(sreg->parent, uA - sreg->cur_current);
+	spin_unlock_irqrestore(&sreg->parent->lock, flags);
+	if (ret)
+		return ret;
+
+	if (uA < sreg->cur_current)
+		wake_up_all(&sreg->parent->wait_q);
+	sreg->cur_current = uA;
+	return 0;
+}
+
+static int cur_reg_locked_charge(struct mxs_regulator *sreg, int uA)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&sreg->lock, flags);
+	ret = cur_reg_try_charge(sreg, uA);
+	spin_unlock_irqrestore(&sreg->lock, flags);
+	return ret;
+}
+
+static int cur_reg_charge(struct mxs_regulator *sreg, int uA)
+{
+	int ret;
+
+	if (!sreg->parent) {
+		sreg->cur_current = uA;
+		return 0;
+	}
+
+	ret = cur_reg_locked_charge(sreg, uA);
+	if (!ret)
+		return 0;
+
+	if (sreg->mode == REGULATOR_MODE_FAST)
+		return ret;
+
+	while (ret) {
+		wait_event(sreg->parent->wait_q, cur_reg_fits(sreg, uA));
+		ret = cur_reg_locked_charge(sreg, uA);
+	}
+	return 0;
+}
+
+static void cur_reg_release_work(struct work_struct *work)
+{
+	struct mxs_sibling_regulator *sib = container_of(to_delayed_work(work),
+				struct mxs_sibling_regulator, release_work);
+	unsigned long flags;
+
+	spin_lock_irqsave(&sib->sreg.lock, flags);
+	if (sib->enabled && !sib->acquiring &&
+	    sib->req_current < sib->sreg.cur_current)
+		cur_reg_try_charge(&sib->sreg, sib->req_current);
+	spin_unlock_irqrestore(&sib->sreg.lock, flags);
+}
+
+/*
+ * acquire_work runs on the shared workqueue, so it waits for budget
+ * at most CUR_REG_ACQUIRE_WAIT_MS at a time, then requeues itself and
+ * lets the work queued behind it run. disable_cur_reg() and the
+ * unbound notifier wake parent->wait_q when they end the wait.
+ */
+#define CUR_REG_ACQUIRE_WAIT_MS	20
+
+static void cur_reg_acquire_work(struct work_struct *work)
+{
+	struct mxs_sibling_regulator *sib =
+		container_of(work, struct mxs_sibling_regulator, acquire_work);
+	struct mxs_regulator *sreg = &sib->sreg;
+	unsigned long flags;
+	int done;
+
+	wait_event_timeout(sreg->parent->wait_q, !ACCESS_ONCE(sib->enabled) ||
+			   cur_reg_fits(sreg, ACCESS_ONCE(sib->req_current)),
+			   msecs_to_jiffies(CUR_REG_ACQUIRE_WAIT_MS));
+
+	spin_lock_irqsave(&sreg->lock, flags);
+	done = !sib->enabled || !cur_reg_try_charge(sreg, sib->req_current);
+	if (done)
+		sib->acquiring = 0;
+	spin_unlock_irqrestore(&sreg->lock, flags);
+
+	if (!done)
+		schedule_work(&sib->acquire_work);
+}
+
+static int cur_reg_set_current(struct mxs_regulator *sreg, int uA)
+{
+	struct mxs_sibling_regulator *sib;
+	unsigned long flags;
+	int deferred;
+	int ret;
+
+	pr_debug("%s: enter reg %s, uA=%d\n",
+		 __func__, sreg->regulator.name, uA);
+
+	if (!sreg->parent)
+		return cur_reg_charge(sreg, uA);
+
+	sib = to_sibling(sreg);
+	spin_lock_irqsave(&sreg->lock, flags);
+	sib->req_current = uA;
+	deferred = !sib->enabled || sib->acquiring;
+	spin_unlock_irqrestore(&sreg->lock, flags);
+
+	/* charged on enable, or picked up by the pending acquire_work */
+	if (deferred) {
+		wake_up_all(&sreg->parent->wait_q);
+		return 0;
+	}
+
+	if (sib->coalesce_ms && uA < sreg->cur_current) {
+		/* give the budget back lazily, a new increase cancels it */
+		schedule_delayed_work(&sib->release_work,
+				      msecs_to_jiffies(sib->coalesce_ms));
+		return 0;
+	}
+
+	cancel_delayed_work_sync(&sib->release_work);
+	if (uA == sreg->cur_current)
+		return 0;
+
+	ret = cur_reg_charge(sreg, uA);
+	if (ret)
+		sib->req_current = sreg->cur_current;
+	return ret;
+}
+
+static int cur_reg_get_current(struct mxs_regulator *sreg)
+{
+	if (sreg->parent)
+		return to_sibling(sreg)->req_current;
+	return sreg->cur_current;
+}
+
+static int enable_cur_reg(struct mxs_regulator *sreg)
+{
+	struct mxs_sibling_regulator *sib;
+	unsigned long flags;
+	int queue = 0;
+
+	if (!sreg->parent)
+		return 0;
+
+	sib = to_sibling(sreg);
+	spin_lock_irqsave(&sreg->lock, flags);
+	sib->enabled = 1;
+	if (cur_reg_try_charge(sreg, sib->req_current)) {
+		sib->acquiring = 1;
+		queue = 1;
+	}
+	spin_unlock_irqrestore(&sreg->lock, flags);
+
+	/* don't hold up the consumer's resume waiting for budget */
+	if (queue)
+		schedule_work(&sib->acquire_work);
+	return 0;
+}
+
+static int disable_cur_reg(struct mxs_regulator *sreg)
+{
+	struct mxs_sibling_regulator *sib;
+	unsigned long flags;
+
+	if (!sreg->parent)
+		return 0;
+
+	sib = to_sibling(sreg);
+	spin_lock_irqsave(&sreg->lock, flags);
+	sib->enabled = 0;
+	spin_unlock_irqrestore(&sreg->lock, flags);
+
+	wake_up_all(&sreg->parent->wait_q);
+	cancel_work_sync(&sib->acquire_work);
+	cancel_delayed_work_sync(&sib->release_work);
+
+	spin_lock_irqsave(&sreg->lock, flags);
+	sib->acquiring = 0;
+	cur_reg_try_charge(sreg, 0);
+	spin_unlock_irqrestore(&sreg->lock, flags);
+	return 0;
+}
+
+static int cur_reg_is_enabled(struct mxs_regulator *sreg)
+{
+	if (sreg->parent)
+		return to_sibling(sreg)->enabled;
+	return 1;
+}
+
+static int cur_reg_set_mode(struct mxs_regulator *sreg, int mode)
+{
+	int ret = 0;
+
+	switch (mode) {
+	case REGULATOR_MODE_NORMAL:
+	case REGULATOR_MODE_FAST:
+		sreg->mode = mode;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	return ret;
+}
+
+static int cur_reg_get_mode(struct mxs_regulator *sreg)
+{
+	return sreg->mode;
+}
+
+static int cur_rop_set_current(struct regulator_dev *rdev,
+			       int min_uA, int uA)
+{
+	u64 t = power_trace_begin();
+	int ret = cur_reg_set_current(rdev_get_drvdata(rdev), uA);
+
+	power_trace_range(rdev, POWER_TRACE_SET_CURRENT, min_uA, uA, ret, t);
+	return ret;
+}
+
+static int cur_rop_get_current(struct regulator_dev *rdev)
+{
+	return cur_reg_get_current(rdev_get_drvdata(rdev));
+}
+
+static int cur_rop_enable(struct regulator_dev *rdev)
+{
+	u64 t = power_trace_begin();
+	int ret = enable_cur_reg(rdev_get_drvdata(rdev));
+
+	power_trace_end(rdev, POWER_TRACE_ENABLE, 1, ret, t);
+	return ret;
+}
+
+static int cur_rop_disable(struct regulator_dev *rdev)
+{
+	u64 t = power_trace_begin();
+	int ret = disable_cur_reg(rdev_get_drvdata(rdev));
+
+	power_trace_end(rdev, POWER_TRACE_DISABLE, 0, ret, t);
+	return ret;
+}
+
+static int cur_rop_is_enabled(struct regulator_dev *rdev)
+{
+	return cur_reg_is_enabled(rdev_get_drvdata(rdev));
+}
+
+static int cur_rop_set_mode(struct regulator_dev *rdev, unsigned int mode)
+{
+	u64 t = power_trace_begin();
+	int ret = cur_reg_set_mode(rdev_get_drvdata(rdev), mode);
+
+	power_trace_end(rdev, POWER_TRACE_SET_MODE, mode, ret, t);
+	return ret;
+}
+
+static unsigned int cur_rop_get_mode(struct regulator_dev *rdev)
+{
+	return cur_reg_get_mode(rdev_get_drvdata(rdev));
+}
+
+static struct regulator_ops cur_rops = {
+	.set_current_limit	= cur_rop_set_current,
+	.get_current_limit	= cur_rop_get_current,
+	.enable		= cur_rop_enable,
+	.disable	= cur_rop_disable,
+	.is_enabled	= cur_rop_is_enabled,
+	.set_mode	= cur_rop_set_mode,
+	.get_mode	= cur_rop_get_mode,
+};
+
+static struct mxs_platform_regulator_data overall_cur_data = {
+	.name		= "overall_current",
+	.set_current	= cur_reg_set_current,
+	.get_current	= cur_reg_get_current,
+	.enable		= enable_cur_reg,
+	.disable	= disable_cur_reg,
+	.is_enabled	= cur_reg_is_enabled,
+	.set_mode	= cur_reg_set_mode,
+	.get_mode	= cur_reg_get_mode,
+	.max_current	= 0x7fffffff,
+};
+
+static struct regulator_consumer_supply overall_cur_supply = {
+	.supply		= "overall_current",
+};
+
+static struct regulator_init_data overall_cur_init = {
+	.consumer_supplies	= &overall_cur_supply,
+	.num_consumer_supplies	= 1,
+	.constraints = {
+		.name			= "overall_current",
+		.valid_modes_mask	= REGULATOR_MODE_NORMAL |
+					  REGULATOR_MODE_FAST,
+		.valid_ops_mask		= REGULATOR_CHANGE_CURRENT |
+					  REGULATOR_CHANGE_MODE,
+		.max_uA                 = 0x7fffffff,
+		.min_uA                 = 0x0,
+		.always_on		= 1,
+	}
+};
+
+static struct mxs_platform_regulator_data sibling_cur_data = {
+	.parent_name	= "overall_current",
+	.set_current	= cur_reg_set_current,
+	.get_current	= cur_reg_get_current,
+	.enable		= enable_cur_reg,
+	.disable	= disable_cur_reg,
+	.is_enabled	= cur_reg_is_enabled,
+	.set_mode	= cur_reg_set_mode,
+	.get_mode	= cur_reg_get_mode,
+};
+
+
+static const char *device_names[] = {
+	"mxs-duart", "mxs-bl", "mxs-i2c"
+};
+
+static int sibling_current_devices_num;
+#define MX28EVK_BL_COALESCE_MS 20
+
+int mxs_platform_add_regulator(const char *name, int count)
+{
+	struct mxs_sibling_group *group;
+	int i, ret;
+
+	pr_debug("%s: name %s, count %d\n", __func__, name, count);
+	group = kzalloc(sizeof(*group) + count * sizeof(group->sib[0]),
+			GFP_KERNEL);
+	if (!group)
+		return -ENOMEM;
+	group->count = count;
+
+	for (i = 0; i < count; i++) {
+		struct mxs_sibling_regulator *sib = &group->sib[i];
+		struct regulator_init_data *sibling_init = &sib->init;
+		struct mxs_platform_regulator_data *d = &sib->rdata;
+
+		sibling_init->constraints.valid_modes_mask =
+			REGULATOR_MODE_NORMAL | REGULATOR_MODE_FAST;
+		sibling_init->constraints.valid_ops_mask =
+			REGULATOR_CHANGE_CURRENT | REGULATOR_CHANGE_MODE |
+			REGULATOR_CHANGE_STATUS;
+		sibling_init->constraints.max_uA = 0x7fffffff;
+		sibling_init->constraints.min_uA = 0x0;
+		sibling_init->constraints.always_on = 1;
+
+		memcpy(d, &sibling_cur_data, sizeof(sibling_cur_data));
+		snprintf(d->name, sizeof(d->name), "%s-%d", name, i + 1);
+		sibling_init->constraints.name = d->name;
+		sib->supply.supply = d->name;
+		sibling_init->consumer_supplies = &sib->supply;
+		sibling_init->num_consumer_supplies = 1;
+		sib->sreg.rdata = d;
+		/* charges now count against, and wait for, overall_current */
+		sib->sreg.parent = &overall_cur_reg;
+		sib->enabled = 1;
+		sib->rail.sreg = &sib->sreg;
+		sib->rail.id = 101 + sibling_current_devices_num + i;
+		sib->rail.initdata = sibling_init;
+		sib->rail.ops = &cur_rops;
+		INIT_DELAYED_WORK(&sib->release_work, cur_reg_release_work);
+		INIT_WORK(&sib->acquire_work, cur_reg_acquire_work);
+	}
+
+	mutex_lock(&sibling_list_lock);
+	list_add_tail(&group->node, &sibling_groups);
+	mutex_unlock(&sibling_list_lock);
+
+	for (i = 0; i < count; i++) {
+		ret = mxs_register_regulators(&group->sib[i].rail, 1);
+		if (ret)
+			goto err;
+	}
+	sibling_current_devices_num += count;
+	return 0;
+
+err:
+	/* the failed rail is already off the driver's list */
+	mutex_lock(&sibling_list_lock);
+	list_del(&group->node);
+	while (--i >= 0)
+		mxs_unregister_regulators(&group->sib[i].rail, 1);
+	mutex_unlock(&sibling_list_lock);
+	kfree(group);
+	return ret;
+}
+
+/*
+ * Undo mxs_platform_add_regulator(name, count): the siblings are
+ * unregistered, which hands their budget back to overall_current,
+ * and freed.
+ */
+int mxs_platform_del_regulator(const char *name, int count)
+{
+	struct mxs_sibling_group *group;
+	char sname[80];
+	int i, ret = -ENODEV;
+
+	snprintf(sname, sizeof(sname), "%s-1", name);
+
+	mutex_lock(&sibling_list_lock);
+	list_for_each_entry(group, &sibling_groups, node) {
+		if (group->count != count ||
+		    strcmp(group->sib[0].rdata.name, sname))
+			continue;
+		list_del(&group->node);
+		for (i = 0; i < count; i++)
+			mxs_unregister_regulators(&group->sib[i].rail, 1);
+		kfree(group);
+		ret = 0;
+		break;
+	}
+	mutex_unlock(&sibling_list_lock);
+
+	return ret;
+}
+
+/* must be called with sibling_list_lock held */
+static struct mxs_sibling_regulator *power_find_sibling(const char *name)
+{
+	struct mxs_sibling_group *group;
+	int i;
+
+	list_for_each_entry(group, &sibling_groups, node)
+		for (i = 0; i < group->count; i++)
+			if (!strcmp(group->sib[i].rdata.name, name))
+				return &group->sib[i];
+	return NULL;
+}
+
+/* copy the name of the idx-th sibling, to look it up without the lock */
+static int power_sibling_name(int idx, char *name, size_t len)
+{
+	struct mxs_sibling_group *group;
+	int ret = -ENODEV;
+
+	mutex_lock(&sibling_list_lock);
+	list_for_each_entry(group, &sibling_groups, node) {
+		if (idx < group->count) {
+			strlcpy(name, group->sib[idx].rdata.name, len);
+			ret = 0;
+			break;
+		}
+		idx -= group->count;
+	}
+	mutex_unlock(&sibling_list_lock);
+
+	return ret;
+}
+
+/*
+ * Let a high-frequency consumer (e.g. a backlight ramp) batch its
+ * set_current_limit calls: increases are charged at once, decreases
+ * are released to overall_current after window_ms. 0 disables it.
+ */
+int mxs_platform_set_current_coalesce(const char *name,
+				      unsigned int window_ms)
+{
+	struct mxs_sibling_regulator *sib;
+	int ret = -ENODEV;
+
+	mutex_lock(&sibling_list_lock);
+	sib = power_find_sibling(name);
+	if (sib) {
+		sib->coalesce_ms = window_ms;
+		if (!window_ms)
+			flush_delayed_work(&sib->release_work);
+		ret = 0;
+	}
+	mutex_unlock(&sibling_list_lock);
+
+	return ret;
+}
+
+/*
+ * Let the consumer release the sibling's budget with regulator_disable()
+ * while it is suspended. Call it from probe, before regulator_enable():
+ * the core only passes enable/disable through once always_on is clear.
+ */
+int mxs_platform_set_current_pm(const char *name, int pm)
+{
+	struct mxs_sibling_regulator *sib;
+	int ret = -ENODEV;
+
+	mutex_lock(&sibling_list_lock);
+	sib = power_find_sibling(name);
+	if (sib) {
+		sib->init.constraints.always_on = !pm;
+		/* back to always on, take the budget again if it was given up */
+		if (!pm)
+			enable_cur_reg(&sib->sreg);
+		ret = 0;
+	}
+	mutex_unlock(&sibling_list_lock);
+
+	return ret;
+}
+
+/* whether the sibling gives up its load on a VDD5V droop */
+int mxs_platform_set_current_shed(const char *name, int shed)
+{
+	struct mxs_sibling_regulator *sib;
+	int ret = -ENODEV;
+
+	mutex_lock(&sibling_list_lock);
+	sib = power_find_sibling(name);
+	if (sib) {
+		sib->shed = shed;
+		ret = 0;
+	}
+	mutex_unlock(&sibling_list_lock);
+
+	return ret;
+}
+
+/*
+ * A consumer that unbinds without setting its limit back to 0 would
+ * keep its charge for good: once the last consumer of a sibling has
+ * called regulator_put(), give the budget back. Only platform devices
+ * are watched, which is where all sibling consumers live. The core
+ * adds consumers and calls set_current_limit under rdev->mutex, so
+ * the test and the release are made under it too: a consumer that
+ * just got the sibling and charged it keeps its charge.
+ */
+static int power_sibling_unbound(struct notifier_block *nb,
+				 unsigned long action, void *data)
+{
+	struct mxs_sibling_group *group;
+	struct mxs_sibling_regulator *sib;
+	struct regulator_dev *rdev;
+	unsigned long flags;
+	int i;
+
+	if (action != BUS_NOTIFY_UNBOUND_DRIVER)
+		return NOTIFY_DONE;
+
+	mutex_lock(&sibling_list_lock);
+	list_for_each_entry(group, &sibling_groups, node)
+		for (i = 0; i < group->count; i++) {
+			sib = &group->sib[i];
+			rdev = sib->rail.rdev;
+			if (!rdev)
+				continue;
+			mutex_lock(&rdev->mutex);
+			if (list_empty(&rdev->consumer_list)) {
+				spin_lock_irqsave(&sib->sreg.lock, flags);
+				sib->req_current = 0;
+				if (!sib->acquiring)
+					cur_reg_try_charge(&sib->sreg, 0);
+				spin_unlock_irqrestore(&sib->sreg.lock, flags);
+				/* nothing left for acquire_work to wait for */
+				wake_up_all(&sib->sreg.parent->wait_q);
+			}
+			mutex_unlock(&rdev->mutex);
+		}
+	mutex_unlock(&sibling_list_lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block power_sibling_nb = {
+	.notifier_call = power_sibling_unbound,
+};
+
+static struct mxs_dcdc_regulator vddd_reg = {
+	.sreg.rdata = &vddd_data,
+	.ramp_step = 2,
+	.ramp_step_us = 50,
+};
+
+static struct mxs_dcdc_regulator vdda_reg = {
+	.sreg.rdata = &vdda_data,
+};
+
+static struct mxs_dcdc_regulator vddio_reg = {
+	.sreg.rdata = &vddio_data,
+};
+
+static struct mxs_regulator vdddbo_reg = {
+		.rdata = &vdddbo_data,
+};
+
+static struct mxs_regulator overall_cur_reg = {
+		.rdata = &overall_cur_data,
+};
+
+static struct mxs_regulator vbus5v_reg = {
+		.rdata = &vbus5v_data,
+};
+
+static struct mxs_regulator_rail mx28evk_rails[] = {
+	{ .sreg = &vddd_reg.sreg, .id = MXS_VDDD, .initdata = &vddd_init,
+	  .ops = &dcdc_rops, },
+	{ .sreg = &vdddbo_reg, .id = MXS_VDDDBO, .initdata = &vdddbo_init,
+	  .ops = &bo_rops, },
+	{ .sreg = &vdda_reg.sreg, .id = MXS_VDDA, .initdata = &vdda_init,
+	  .ops = &dcdc_rops, },
+	{ .sreg = &vddio_reg.sreg, .id = MXS_VDDIO, .initdata = &vddio_init,
+	  .ops = &dcdc_rops, },
+	{ .sreg = &overall_cur_reg, .id = MXS_OVERALL_CUR,
+	  .initdata = &overall_cur_init, .ops = &cur_rops,
+	  .nb = &power_droop_nb, },
+	{ .sreg = &vbus5v_reg, .id = MX28EVK_VBUS5v, .initdata = &vbus5v_init,
+	  .ops = &vbus5v_rops, },
+};
+
+/*
+ * Predicted time for a DC-DC rail to go from old_uV to new_uV, in us,
+ * so cpufreq can overlap the change with other work instead of blocking
+ * on it. The regulator core of this kernel has no set_voltage_time_sel
+ * hook, so the rail is named by its MXS_* id here.
+ */
+int mxs_regulator_set_voltage_time(int id, int old_uV, int new_uV)
+{
+	struct mxs_dcdc_regulator *dcdc = NULL;
+	u32 per_step, tick_ns;
+	int i, steps, ticks;
+
+	for (i = 0; i < ARRAY_SIZE(mx28evk_rails); i++)
+		if (mx28evk_rails[i].id == id &&
+		    mx28evk_rails[i].ops == &dcdc_rops)
+			dcdc = to_dcdc(mx28evk_rails[i].sreg);
+	if (!dcdc)
+		return -EINVAL;
+
+	steps = abs(power_uv_to_code(&dcdc->sreg, new_uV, 0) -
+		    power_uv_to_code(&dcdc->sreg, old_uV, 0));
+	if (!steps)
+		return 0;
+
+	/* the learned figure plus the margin set_voltage() polls through */
+	per_step = dcdc->settle_ns_per_step;
+	per_step = per_step ? per_step + per_step / 4 :
+		   POWER_SETTLE_DEFAULT_NS_PER_STEP;
+
+	if (!dcdc->ramp_step || !dcdc->ramp_step_us ||
+	    steps <= dcdc->ramp_step)
+		return DIV_ROUND_UP(steps * per_step, NSEC_PER_USEC);
+
+	/* each ramp step is checked on ticks, plus the tick seeing the end */
+	tick_ns = dcdc->ramp_step_us * NSEC_PER_USEC;
+	ticks = DIV_ROUND_UP(steps, dcdc->ramp_step) *
+		DIV_ROUND_UP(min(steps, (int)dcdc->ramp_step) * per_step,
+			     tick_ns) + 1;
+	return ticks * dcdc->ramp_step_us;
+}
+EXPORT_SYMBOL_GPL(mxs_regulator_set_voltage_time);
+
+/*
+ * DVFS operating points. mxs_power_set_opp() raises vddd and the
+ * cpufreq budget before the clocks go up and lowers them after the
+ * clocks come down. Each point carries its vddd code and brownout
+ * margin precomputed, vddd moves through the regulator core like any
+ * other request.
+ */
+static struct mxs_power_opp mx28evk_opps[] = {
+	{ .cpu_khz = 64000, .emi_khz = 64000,
+	  .vddd_uV = 1200000, .vddd_bo_uV = 1100000, .cur_uA = 100000,
+	  .speed_min = 3000, },
+	{ .cpu_khz = 261818, .emi_khz = 130910,
+	  .vddd_uV = 1350000, .vddd_bo_uV = 1250000, .cur_uA = 173000,
+	  .speed_min = 4300, },
+	{ .cpu_khz = 360000, .emi_khz = 120000,
+	  .vddd_uV = 1450000, .vddd_bo_uV = 1350000, .cur_uA = 200000,
+	  .speed_min = 5400, },
+	{ .cpu_khz = 454736, .emi_khz = 151570,
+	  .vddd_uV = 1550000, .vddd_bo_uV = 1450000, .cur_uA = 355000,
+	  .speed_min = 6500, },
+};
+
+#define MX28EVK_CPUFREQ_SIBLING "cpufreq-1"
+
+/*
+ * AVS: at each operating point vddd is walked down while the ARM ring
+ * oscillator still counts at least speed_min, but no further than
+ * POWER_AVS_FLOOR_STEPS, and the lowest code that passes plus
+ * POWER_AVS_GUARD_STEPS becomes the point's code. The result is
+ * printed by debugfs mxs-power/avs in the format of the mxs_avs= boot
+ * option, so it can be kept per chip and handed back to later boots,
+ * which hold it to the same floor and check it against the sensor.
+ */
+#define POWER_AVS_GUARD_STEPS	1
+#define POWER_AVS_FLOOR_STEPS	4	/* 100 mV below the point at most */
+#define POWER_SPEED_SETTLE_US	10
+
+/* the sensor sequence is not atomic, AVS and the sampler share it */
+static DEFINE_MUTEX(power_speed_lock);
+
+static u32 power_avs_enable;
+static int power_avs_boot[ARRAY_SIZE(mx28evk_opps)];
+static int power_avs_boot_num;
+
+static int __init power_avs_setup(char *str)
+{
+	int ints[ARRAY_SIZE(power_avs_boot) + 1];
+	int i;
+
+	get_options(str, ARRAY_SIZE(ints), ints);
+	power_avs_boot_num = ints[0];
+	for (i = 0; i < ints[0]; i++)
+		power_avs_boot[i] = ints[i + 1];
+	return 1;
+}
+__setup("mxs_avs=", power_avs_setup);
+
+/* one reading of the speed sensor on the given STATUS_SEL source */
+static u32 power_speed_read(u32 sel)
+{
+	u32 val;
+
+	mutex_lock(&power_speed_lock);
+	power_update_bits(HW_POWER_SPEED, BM_POWER_SPEED_CTRL |
+			  BM_POWER_SPEED_STATUS_SEL,
+			  BF_POWER_SPEED_CTRL(3) |
+			  BF_POWER_SPEED_STATUS_SEL(sel));
+	power_udelay(POWER_SPEED_SETTLE_US);
+	val = (power_readl(HW_POWER_SPEED) & BM_POWER_SPEED_STATUS) >>
+		BP_POWER_SPEED_STATUS;
+	power_update_bits(HW_POWER_SPEED, BM_POWER_SPEED_CTRL, 0);
+	mutex_unlock(&power_speed_lock);
+
+	return val;
+}
+
+/*
+ * Background sampler: every speed_period_ms all three speed sensor
+ * sources are read into power_speed_cache, which mxs_power_speed_get()
+ * hands out under a seqlock, so a consumer pays a memory load rather
+ * than the sensor sequence. The sensor costs power, so the sampler
+ * only runs while someone reads: the first reader starts it, and it
+ * stops once nobody asked for POWER_SPEED_IDLE_MS.
+ */
+#define POWER_SPEED_SOURCES	3
+#define POWER_SPEED_IDLE_MS	1000
+
+static struct {
+	u32 status[POWER_SPEED_SOURCES];
+	u64 ts_ns;			/* 0 until the first sample */
+} power_speed_cache;
+
+static DEFINE_SEQLOCK(power_speed_seq);
+static u32 speed_period_ms = 100;
+static struct delayed_work power_speed_work;
+static unsigned long power_speed_last_get;	/* jiffies */
+static unsigned long power_speed_running;
+
+static int power_speed_idle(void)
+{
+	return time_after(jiffies, ACCESS_ONCE(power_speed_last_get) +
+			  msecs_to_jiffies(POWER_SPEED_IDLE_MS));
+}
+
+static void power_speed_sample(struct work_struct *work)
+{
+	u32 status[POWER_SPEED_SOURCES];
+	unsigned long flags;
+	int i;
+
+	if (speed_period_ms) {
+		for (i = 0; i < POWER_SPEED_SOURCES; i++)
+			status[i] = power_speed_read(i);
+
+		write_seqlock_irqsave(&power_speed_seq, flags);
+		memcpy(power_speed_cache.status, status, sizeof(status));
+		power_speed_cache.ts_ns = power_now_ns();
+		write_sequnlock_irqrestore(&power_speed_seq, flags);
+	}
+
+	if (power_speed_idle()) {
+		clear_bit(0, &power_speed_running);
+		smp_mb__after_clear_bit();
+		/* unless a reader came in and found us still running */
+		if (power_speed_idle() ||
+		    test_and_set_bit(0, &power_speed_running))
+			return;
+	}
+
+	/* a period of 0 pauses sampling, look again in a second */
+	schedule_delayed_work(&power_speed_work,
+			      msecs_to_jiffies(speed_period_ms ?: 1000));
+}
+
+/*
+ * Latest count of STATUS_SEL source sel, and in *age_us how old it is.
+ * -EAGAIN until the sampler has run once; a reader after a quiet spell
+ * gets the old sample, with its age, and starts the sampler again.
+ */
+int mxs_power_speed_get(unsigned int sel, u32 *age_us)
 {
-	int uv;
-	int offs;
+	unsigned int seq;
+	u32 status;
+	u64 ts;
 
-	if (!sreg->parent)
+	if (sel >= POWER_SPEED_SOURCES)
 		return -EINVAL;
 
-	uv = get_voltage(sreg->parent);
-	offs = (__raw_readl(sreg->parent->rdata->control_reg) & ~0x700) >> 8;
-	return uv - 25000*offs;
+	power_speed_last_get = jiffies;
+	smp_mb();
+	if (!test_and_set_bit(0, &power_speed_running))
+		schedule_delayed_work(&power_speed_work, 0);
+
+	do {
+		seq = read_seqbegin(&power_speed_seq);
+		status = power_speed_cache.status[sel];
+		ts = power_speed_cache.ts_ns;
+	} while (read_seqretry(&power_speed_seq, seq));
+
+	if (!ts)
+		return -EAGAIN;
+	if (age_us)
+		*age_us = min_t(u64, div_u64(power_now_ns() - ts,
+					     NSEC_PER_USEC), U32_MAX);
+	return status;
 }
+EXPORT_SYMBOL_GPL(mxs_power_speed_get);
 
-static int set_voltage(struct mxs_regulator *sreg, int uv)
+static void power_speed_init(void)
+{
+	INIT_DELAYED_WORK(&power_speed_work, power_speed_sample);
+}
+
+/* debugfs mxs-power/speed: the cached samples and their age */
+static int power_speed_show(struct seq_file *s, void *unused)
 {
-	u32 val, reg, i;
+	static const char *names[POWER_SPEED_SOURCES] = {
+		"dcdc", "core", "arm",
+	};
+	u32 age;
+	int i, val;
+
+	for (i = 0; i < POWER_SPEED_SOURCES; i++) {
+		val = mxs_power_speed_get(i, &age);
+		if (val < 0)
+			seq_printf(s, "%-5s none\n", names[i]);
+		else
+			seq_printf(s, "%-5s %6d age %u us\n", names[i], val,
+				   age);
+	}
+	return 0;
+}
 
-	pr_debug("%s: uv %d, min %d, max %d\n", __func__,
-		uv, sreg->rdata->min_voltage, sreg->rdata->max_voltage);
+static int power_speed_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, power_speed_show, inode->i_private);
+}
 
-	if (uv < sreg->rdata->min_voltage || uv > sreg->rdata->max_voltage)
-		return -EINVAL;
+static const struct file_operations power_speed_fops = {
+	.open		= power_speed_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-	if (sreg->rdata->control_reg ==
-		(u32)(REGS_POWER_BASE + HW_POWER_VDDIOCTRL))
-		val = (uv - sreg->rdata->min_voltage) / 50000;
-	else
-		val = (uv - sreg->rdata->min_voltage) * 0x1f /
-			(sreg->rdata->max_voltage - sreg->rdata->min_voltage);
-	reg = (__raw_readl(sreg->rdata->control_reg) & ~0x1f);
-	pr_debug("%s: calculated val %d\n", __func__, val);
-	__raw_writel(val | reg, sreg->rdata->control_reg);
-	for (i = 20; i; i--) {
-		if (__raw_readl(REGS_POWER_BASE + HW_POWER_STS) & BM_POWER_STS_DC_OK)
+/*
+ * A walk holds the vddd rdev->mutex from its first step to its last
+ * sensor reading, as the core does around a consumer request, so a
+ * request neither overwrites a step nor lands between a step and its
+ * reading. Before the rail is registered there are no consumers.
+ */
+static struct regulator_dev *power_avs_rdev(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mx28evk_rails); i++)
+		if (mx28evk_rails[i].sreg == &vddd_reg.sreg)
+			return mx28evk_rails[i].rdev;
+	return NULL;
+}
+
+static void power_avs_lock(void)
+{
+	struct regulator_dev *rdev = power_avs_rdev();
+
+	if (rdev)
+		mutex_lock(&rdev->mutex);
+}
+
+static void power_avs_unlock(void)
+{
+	struct regulator_dev *rdev = power_avs_rdev();
+
+	if (rdev)
+		mutex_unlock(&rdev->mutex);
+}
+
+/*
+ * AVS moves vddd below what the consumers asked for, so it writes the
+ * code itself, through the same path as a request. Called between
+ * power_avs_lock() and power_avs_unlock().
+ */
+static int power_avs_set_code(int code)
+{
+	struct mxs_dcdc_regulator *dcdc = &vddd_reg;
+	int ret;
+
+	/* a deferred decrease must not land in the middle of a walk */
+	cancel_delayed_work_sync(&dcdc->down_work);
+
+	mutex_lock(&dcdc->lock);
+	dcdc->base_code = code;
+	ret = power_dcdc_write(dcdc, power_loadline_code(dcdc, code), code);
+	mutex_unlock(&dcdc->lock);
+
+	return ret ? -ETIMEDOUT : 0;
+}
+
+static int power_avs_floor(const struct mxs_power_opp *opp)
+{
+	return max(opp->vddd_code - POWER_AVS_FLOOR_STEPS, 0);
+}
+
+static int power_avs_arm_ok(const struct mxs_power_opp *opp)
+{
+	return power_speed_read(BV_POWER_SPEED_STATUS_SEL__ARM_STAT) >=
+	       opp->speed_min;
+}
+
+static void power_avs_store(struct mxs_power_opp *opp, int code)
+{
+	opp->avs_code = code;
+	opp->avs_verified = 1;
+}
+
+/* the code a switch to opp goes to */
+static int power_opp_code(const struct mxs_power_opp *opp)
+{
+	return opp->avs_verified ? opp->avs_code : opp->vddd_code;
+}
+
+/* walk vddd down at opp, which the clocks already run at */
+static void power_avs_walk(struct mxs_power_opp *opp)
+{
+	int code = opp->vddd_code;
+	int pass = code;
+
+	power_avs_lock();
+	while (code > power_avs_floor(opp)) {
+		if (power_avs_set_code(code - 1))
 			break;
-		udelay(1);
+		if (!power_avs_arm_ok(opp))
+			break;
+		pass = --code;
 	}
 
-	if (i)
-		goto out;
+	pass = min(pass + POWER_AVS_GUARD_STEPS, opp->vddd_code);
+	power_avs_set_code(pass);
+	power_avs_unlock();
+	power_avs_store(opp, pass);
+}
 
-	__raw_writel(val | reg, sreg->rdata->control_reg);
-	for (i = 40000; i; i--) {
-		if (__raw_readl(REGS_POWER_BASE + HW_POWER_STS) & BM_POWER_STS_DC_OK)
-			break;
-		udelay(1);
+/*
+ * A code from mxs_avs= was learnt on some chip, maybe not this one.
+ * The point is switched to at its nominal code until the first time
+ * it runs; then the code is tried and stepped back up, at worst to
+ * nominal, until the ARM sensor agrees.
+ */
+static void power_avs_verify(struct mxs_power_opp *opp)
+{
+	int code = opp->avs_code;
+	int raised = 0;
+
+	power_avs_lock();
+	if (!power_avs_set_code(code)) {
+		while (code < opp->vddd_code && !power_avs_arm_ok(opp)) {
+			raised = 1;
+			if (power_avs_set_code(++code)) {
+				code = opp->vddd_code;
+				break;
+			}
+		}
+	} else
+		code = opp->vddd_code;
+
+	if (raised)
+		code = min(code + POWER_AVS_GUARD_STEPS, opp->vddd_code);
+	if (code != opp->avs_code)
+		pr_warning("mxs_avs: point %u kHz code %d fails, using %d\n",
+			   opp->cpu_khz, opp->avs_code, code);
+	power_avs_set_code(code);
+	power_avs_unlock();
+	power_avs_store(opp, code);
+}
+
+static int power_opp_cur = -1;
+static u32 power_opp_switches;
+static DEFINE_MUTEX(power_opp_lock);
+
+static void power_opp_init(void)
+{
+	struct mxs_power_opp *opp;
+	int i, code, uv;
+
+	for (i = 0; i < ARRAY_SIZE(mx28evk_opps); i++) {
+		opp = &mx28evk_opps[i];
+		code = power_uv_to_code(&vddd_reg.sreg, opp->vddd_uV, 1);
+		code = min(code, 0x1f);
+		uv = power_code_to_uv(&vddd_reg.sreg, code);
+		opp->bo_offs = clamp(DIV_ROUND_UP(uv - opp->vddd_bo_uV, 25000),
+				     0, 7);
+		opp->vddd_code = code;
+
+		/*
+		 * Start from what AVS learned on an earlier boot, once
+		 * power_avs_verify() has checked it: only below nominal,
+		 * not under the floor, and not without a sensor minimum
+		 * to check it against.
+		 */
+		if (i >= power_avs_boot_num || power_avs_boot[i] <= 0 ||
+		    power_avs_boot[i] >= code)
+			continue;
+		if (!opp->speed_min) {
+			pr_warning("mxs_avs: point %u kHz has no speed_min, "
+				   "code %d ignored\n", opp->cpu_khz,
+				   power_avs_boot[i]);
+			continue;
+		}
+		opp->avs_code = max(power_avs_boot[i], power_avs_floor(opp));
 	}
+}
 
-	if (i)
-		goto out;
+int mxs_power_opp_count(void)
+{
+	return ARRAY_SIZE(mx28evk_opps);
+}
+EXPORT_SYMBOL_GPL(mxs_power_opp_count);
 
-	for (i = 40000; i; i--) {
-		if (__raw_readl(REGS_POWER_BASE + HW_POWER_STS) & BM_POWER_STS_DC_OK)
-			break;
-		udelay(1);
+const struct mxs_power_opp *mxs_power_get_opp(int index)
+{
+	if (index < 0 || index >= ARRAY_SIZE(mx28evk_opps))
+		return NULL;
+	return &mx28evk_opps[index];
+}
+EXPORT_SYMBOL_GPL(mxs_power_get_opp);
+
+/*
+ * The OPP code is a consumer like any other: vddd and the cpufreq
+ * current sibling are driven through the core, which serialises them
+ * with the other consumers and applies the constraints. The handles
+ * are taken on the first switch, the rails only register at probe.
+ * Must be called with power_opp_lock held.
+ */
+static struct regulator *power_opp_vddd_reg;
+static struct regulator *power_opp_cur_reg;
+
+static int power_opp_get(void)
+{
+	struct regulator *reg;
+
+	if (!power_opp_vddd_reg) {
+		reg = regulator_get(NULL, vddd_data.name);
+		if (IS_ERR(reg))
+			return PTR_ERR(reg);
+		power_opp_vddd_reg = reg;
+	}
+	if (!power_opp_cur_reg) {
+		reg = regulator_get(NULL, MX28EVK_CPUFREQ_SIBLING);
+		if (IS_ERR(reg))
+			return PTR_ERR(reg);
+		regulator_enable(reg);
+		power_opp_cur_reg = reg;
 	}
+	return 0;
+}
 
-out:
-	return !i;
+static int power_opp_charge(int uA)
+{
+	return regulator_set_current_limit(power_opp_cur_reg, uA, uA);
 }
 
-static int set_bo_voltage(struct mxs_regulator *sreg, int bo_uv)
+static int power_opp_vddd(const struct mxs_power_opp *opp)
 {
-	int uv;
-	int offs;
-	u32 reg;
-	int i;
+	struct mxs_dcdc_regulator *dcdc = &vddd_reg;
+	int uv = power_code_to_uv(&dcdc->sreg, power_opp_code(opp));
+	int ret;
+
+	/* the point's margin goes out with the next TRG write */
+	mutex_lock(&dcdc->lock);
+	dcdc->bo_offs = opp->bo_offs;
+	mutex_unlock(&dcdc->lock);
+
+	/* ramped and waited for like any request, > 0 if it didn't settle */
+	ret = regulator_set_voltage(power_opp_vddd_reg, uv, uv);
+	return ret > 0 ? -ETIMEDOUT : ret;
+}
 
-	if (!sreg->parent)
-		return -EINVAL;
+/*
+ * Switch to operating point index. set_clocks moves the CPU and EMI
+ * clocks, it is called between the rail changes.
+ */
+int mxs_power_set_opp(int index,
+		      int (*set_clocks)(const struct mxs_power_opp *opp,
+					void *data),
+		      void *data)
+{
+	const struct mxs_power_opp *opp = mxs_power_get_opp(index);
+	const struct mxs_power_opp *old;
+	int up, ret = 0;
 
-	uv = get_voltage(sreg->parent);
-	offs = (uv - bo_uv) / 25000;
-	if (offs < 0 || offs > 7)
+	if (!opp)
 		return -EINVAL;
 
-	reg = (__raw_readl(sreg->parent->rdata->control_reg) & ~0x700);
-	pr_debug("%s: calculated offs %d\n", __func__, offs);
-	__raw_writel((offs << 8) | reg, sreg->parent->rdata->control_reg);
+	mutex_lock(&power_opp_lock);
+	if (index == power_opp_cur)
+		goto out;
+	ret = power_opp_get();
+	if (ret)
+		goto out;
 
-	for (i = 10000; i; i--) {
-		if (__raw_readl(REGS_POWER_BASE + HW_POWER_STS) & BM_POWER_STS_DC_OK)
-			break;
-		udelay(1);
+	old = mxs_power_get_opp(power_opp_cur);
+	up = !old || opp->vddd_uV >= old->vddd_uV;
+
+	/* up: voltage and budget first */
+	if (up) {
+		ret = power_opp_charge(opp->cur_uA);
+		if (!ret)
+			ret = power_opp_vddd(opp);
+		if (ret)
+			goto out;
 	}
 
-	if (i)
-		goto out;
+	if (set_clocks) {
+		ret = set_clocks(opp, data);
+		if (ret)
+			goto out;
+	}
 
-	for (i = 10000; i; i--) {
-		if (__raw_readl(REGS_POWER_BASE + HW_POWER_STS) & BM_POWER_STS_DC_OK)
-			break;
-		udelay(1);
+	/* down: voltage and budget last */
+	if (!up) {
+		ret = power_opp_vddd(opp);
+		if (!ret)
+			ret = power_opp_charge(opp->cur_uA);
 	}
 
+	if (!ret) {
+		power_opp_cur = index;
+		power_opp_switches++;
+		if (opp->avs_code && !opp->avs_verified)
+			power_avs_verify(&mx28evk_opps[index]);
+		else if (power_avs_enable && !opp->avs_code && opp->speed_min)
+			power_avs_walk(&mx28evk_opps[index]);
+	}
 out:
-	return !i;
+	mutex_unlock(&power_opp_lock);
+
+	return ret;
 }
+EXPORT_SYMBOL_GPL(mxs_power_set_opp);
 
-static int enable(struct mxs_regulator *sreg)
+/* debugfs mxs-power/opp: the table, the current point and switches */
+static int power_opp_show(struct seq_file *s, void *unused)
 {
-	/* XXX: TODO */
+	const struct mxs_power_opp *opp;
+	int i;
+
+	mutex_lock(&power_opp_lock);
+	seq_printf(s, "  %8s %8s %8s %8s %8s %4s %4s\n", "cpu kHz",
+		   "emi kHz", "vddd uV", "bo uV", "uA", "code", "offs");
+	for (i = 0; i < ARRAY_SIZE(mx28evk_opps); i++) {
+		opp = &mx28evk_opps[i];
+		seq_printf(s, "%c %8u %8u %8d %8d %8d %4d %4d\n",
+			   i == power_opp_cur ? '*' : ' ',
+			   opp->cpu_khz, opp->emi_khz, opp->vddd_uV,
+			   opp->vddd_bo_uV, opp->cur_uA, power_opp_code(opp),
+			   opp->bo_offs);
+	}
+	seq_printf(s, "switches %u\n", power_opp_switches);
+	mutex_unlock(&power_opp_lock);
 	return 0;
 }
 
-static int disable(struct mxs_regulator *sreg)
+static int power_opp_open(struct inode *inode, struct file *file)
 {
-	/* XXX: TODO */
-	return 0;
+	return single_open(file, power_opp_show, inode->i_private);
 }
 
-static int is_enabled(struct mxs_regulator *sreg)
+static const struct file_operations power_opp_fops = {
+	.open		= power_opp_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* debugfs mxs-power/avs: the learned codes, as mxs_avs= takes them */
+static int power_avs_show(struct seq_file *s, void *unused)
 {
-	/* XXX: TODO */
-	return 1;
+	int i;
+
+	mutex_lock(&power_opp_lock);
+	seq_printf(s, "mxs_avs=");
+	for (i = 0; i < ARRAY_SIZE(mx28evk_opps); i++)
+		seq_printf(s, "%s%d", i ? "," : "",
+			   mx28evk_opps[i].avs_code);
+	seq_printf(s, "\n");
+	mutex_unlock(&power_opp_lock);
+	return 0;
 }
 
-static int set_mode(struct mxs_regulator *sreg, int mode)
+static int power_avs_open(struct inode *inode, struct file *file)
 {
-	int ret = 0;
-	u32 val;
-
-	switch (mode) {
-	case REGULATOR_MODE_FAST:
-		val = __raw_readl(sreg->rdata->control_reg);
-		__raw_writel(val | (1 << 17), sreg->rdata->control_reg);
-		break;
+	return single_open(file, power_avs_show, inode->i_private);
+}
 
-	case REGULATOR_MODE_NORMAL:
-		val = __raw_readl(sreg->rdata->control_reg);
-		__raw_writel(val & ~(1<<17), sreg->rdata->control_reg);
-		break;
+static const struct file_operations power_avs_fops = {
+	.open		= power_avs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-	default:
-		ret = -EINVAL;
-		break;
+/*
+ * Load-line mode: vddd droops with load, so with loadline_uv_per_ma
+ * set vddd is raised above what was asked for by that much per mA of
+ * budget granted from overall_current, up to loadline_max_uv, and
+ * lowered again as the budget is given back.
+ */
+static void power_loadline_update(struct work_struct *work)
+{
+	struct mxs_dcdc_regulator *dcdc = &vddd_reg;
+	u64 uv;
+	int codes, code;
+
+	uv = (u64)max(ACCESS_ONCE(overall_cur_reg.cur_current), 0) / 1000 *
+		ACCESS_ONCE(power_loadline_uv_per_ma);
+	uv = min_t(u64, uv, power_loadline_max_uv);
+	/* vddd moves 25 mV per TRG code */
+	codes = DIV_ROUND_UP((u32)uv, 25000);
+
+	mutex_lock(&dcdc->lock);
+	if (codes != dcdc->loadline_code) {
+		dcdc->loadline_code = codes;
+		dcdc->loadline_updates++;
+		code = power_loadline_code(dcdc, dcdc->base_code);
+		power_dcdc_write(dcdc, code, code);
 	}
-	return ret;
+	mutex_unlock(&dcdc->lock);
 }
 
-static int get_mode(struct mxs_regulator *sreg)
+static int power_loadline_get(void *data, u64 *val)
 {
-	u32 val = __raw_readl(sreg->rdata->control_reg) & (1 << 17);
+	*val = *(u32 *)data;
+	return 0;
+}
 
-	return val ? REGULATOR_MODE_FAST : REGULATOR_MODE_NORMAL;
+/* a new slope or limit, 0 included, applies at once */
+static int power_loadline_set(void *data, u64 val)
+{
+	*(u32 *)data = val;
+	schedule_work(&power_loadline_work);
+	return 0;
 }
 
-static struct mxs_platform_regulator_data vddd_data = {
-	.name		= "vddd",
-	.set_voltage	= set_voltage,
-	.get_voltage	= get_voltage,
-	.enable		= enable,
-	.disable	= disable,
-	.is_enabled	= is_enabled,
-	.set_mode	= set_mode,
-	.get_mode	= get_mode,
-	.control_reg	= (u32)(REGS_POWER_BASE + HW_POWER_VDDDCTRL),
-	.min_voltage	= 800000,
-	.max_voltage	= 1575000,
-};
+DEFINE_SIMPLE_ATTRIBUTE(power_loadline_fops, power_loadline_get,
+			power_loadline_set, "%llu\n");
 
-static struct mxs_platform_regulator_data vdddbo_data = {
-	.name		= "vddd_bo",
-	.parent_name	= "vddd",
-	.set_voltage	= set_bo_voltage,
-	.get_voltage	= get_bo_voltage,
-	.enable		= enable,
-	.disable	= disable,
-	.is_enabled	= is_enabled,
-	.set_mode	= set_mode,
-	.get_mode	= get_mode,
-	.min_voltage	= 800000,
-	.max_voltage	= 1575000,
+/*
+ * Brownout interrupts of the DC-DC rails. The hard handler raises the
+ * rail one TRG step at once and keeps it there through bo_bump, the
+ * thread logs it, caps the current budget for power_bo_hold_ms and
+ * listens again once DC_OK is back. Each power_bo_hold_ms without a
+ * brownout takes one step back.
+ */
+struct power_bo_irq {
+	struct mxs_dcdc_regulator *dcdc;
+	int irq;
+	u32 irq_bit;
+	u32 en_bit;
+	u32 events;
+	u32 bumps;
+	u64 last_ns;
 };
 
-static struct mxs_platform_regulator_data vdda_data = {
-	.name		= "vdda",
-	.set_voltage	= set_voltage,
-	.get_voltage	= get_voltage,
-	.enable		= enable,
-	.disable	= disable,
-	.is_enabled	= is_enabled,
-	.set_mode	= set_mode,
-	.get_mode	= get_mode,
-	.control_reg	= (u32)(REGS_POWER_BASE + HW_POWER_VDDACTRL),
-	.min_voltage	= 1500000,
-	.max_voltage	= 2275000,
+static struct power_bo_irq power_bo_irqs[] = {
+	{ &vddd_reg, IRQ_VDDD_BRNOUT, BM_POWER_CTRL_VDDD_BO_IRQ,
+	  BM_POWER_CTRL_ENIRQ_VDDD_BO },
+	{ &vdda_reg, IRQ_VDDA_BRNOUT, BM_POWER_CTRL_VDDA_BO_IRQ,
+	  BM_POWER_CTRL_ENIRQ_VDDA_BO },
+	{ &vddio_reg, IRQ_VDDIO_BRNOUT, BM_POWER_CTRL_VDDIO_BO_IRQ,
+	  BM_POWER_CTRL_ENIRQ_VDDIO_BO },
 };
 
-#define MX28EVK_VDDIO_OFFSET 80000
-static struct mxs_platform_regulator_data vddio_data = {
-	.name		= "vddio",
-	.set_voltage	= set_voltage,
-	.get_voltage	= get_voltage,
-	.enable		= enable,
-	.disable	= disable,
-	.is_enabled	= is_enabled,
-	.set_mode	= set_mode,
-	.get_mode	= get_mode,
-	.control_reg	= (u32)(REGS_POWER_BASE + HW_POWER_VDDIOCTRL),
-	.min_voltage	= 2800000 + MX28EVK_VDDIO_OFFSET,
-	.max_voltage	= 3600000 + MX28EVK_VDDIO_OFFSET,
-};
+static u32 power_bo_hold_ms = 1000;
+/* what is left of the granted load while a brownout is held, in 1/8 */
+#define POWER_BO_BUDGET_EIGHTHS	7
 
-static struct regulator_init_data vddd_init = {
-	.constraints = {
-		.name			= "vddd",
-		.min_uV			= 800000,
-		.max_uV			= 1575000,
-		.valid_modes_mask	= REGULATOR_MODE_FAST |
-					  REGULATOR_MODE_NORMAL,
-		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
-					  REGULATOR_CHANGE_MODE,
-		.input_uV		= 5000000,
-		.always_on		= 1,
+/*
+ * The code comes from power_cache. VDDxCTRL have no SET/CLR aliases,
+ * so the step is one read-modify-write of the register that keeps the
+ * bits other code owns. Under ramp_lock so a running ramp carries on
+ * from the raised code.
+ */
+static irqreturn_t power_bo_irq(int irq, void *dev_id)
+{
+	struct power_bo_irq *bo = dev_id;
+	struct mxs_dcdc_regulator *dcdc = bo->dcdc;
+	struct mxs_regulator *sreg = &dcdc->sreg;
+	unsigned long flags;
+	int code, max;
+
+	if (!(power_readl(HW_POWER_CTRL) & bo->irq_bit))
+		return IRQ_NONE;
+	/* ack and mask in one CLR write, the thread unmasks */
+	power_update_bits(HW_POWER_CTRL, bo->irq_bit | bo->en_bit, 0);
+
+	max = power_uv_to_code(sreg, sreg->rdata->max_voltage, 0);
+	spin_lock_irqsave(&dcdc->ramp_lock, flags);
+	code = dcdc->ramping ? dcdc->ramp_code :
+		power_read_bits(power_ctrl_reg(sreg), 0x1f);
+	if (code < max) {
+		power_update_bits(power_ctrl_reg(sreg), POWER_TRG_BO_MASK,
+				  (code + 1) |
+				  power_bo_field(dcdc, code, code + 1));
+		if (dcdc->ramping) {
+			dcdc->ramp_code = code + 1;
+			dcdc->ramp_target = min(dcdc->ramp_target + 1, max);
+		}
+		dcdc->bo_bump++;
+		bo->bumps++;
 	}
-};
+	spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
 
-static struct regulator_init_data vdddbo_init = {
-	.constraints = {
-		.name			= "vdddbo",
-		.min_uV			= 800000,
-		.max_uV			= 1575000,
-		.valid_modes_mask	= REGULATOR_MODE_FAST |
-					  REGULATOR_MODE_NORMAL,
-		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
-					  REGULATOR_CHANGE_MODE,
-		.input_uV		= 5000000,
-		.always_on		= 1,
+	bo->last_ns = power_now_ns();
+	return IRQ_WAKE_THREAD;
+}
+
+static void power_bo_decay(struct work_struct *work)
+{
+	struct mxs_dcdc_regulator *dcdc = container_of(to_delayed_work(work),
+				struct mxs_dcdc_regulator, bo_decay_work);
+	unsigned long flags;
+	int left;
+
+	mutex_lock(&dcdc->lock);
+	spin_lock_irqsave(&dcdc->ramp_lock, flags);
+	if (dcdc->bo_bump)
+		dcdc->bo_bump--;
+	left = dcdc->bo_bump;
+	spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+	power_dcdc_write(dcdc, power_loadline_code(dcdc, dcdc->base_code), 0);
+	mutex_unlock(&dcdc->lock);
+
+	if (left)
+		schedule_delayed_work(&dcdc->bo_decay_work,
+				      msecs_to_jiffies(power_bo_hold_ms));
+}
+
+static irqreturn_t power_bo_thread(int irq, void *dev_id)
+{
+	struct power_bo_irq *bo = dev_id;
+	struct mxs_dcdc_regulator *dcdc = bo->dcdc;
+
+	bo->events++;
+	if (printk_ratelimit())
+		pr_warning("%s: brownout, now %d uV (+%d steps)\n",
+			   dcdc->sreg.rdata->name,
+			   power_code_to_uv(&dcdc->sreg,
+					    power_dcdc_code(dcdc)),
+			   dcdc->bo_bump);
+
+	power_budget_clamp(max(ACCESS_ONCE(overall_cur_reg.cur_current), 0) /
+			   8 * POWER_BO_BUDGET_EIGHTHS);
+	power_budget_hold(POWER_HOLD_BROWNOUT, power_bo_hold_ms);
+
+	mutex_lock(&dcdc->lock);
+	if (power_wait_dc_ok(40000))
+		power_bo_restore(dcdc);
+	mutex_unlock(&dcdc->lock);
+
+	/* a new brownout starts the hold over */
+	cancel_delayed_work_sync(&dcdc->bo_decay_work);
+	schedule_delayed_work(&dcdc->bo_decay_work,
+			      msecs_to_jiffies(power_bo_hold_ms));
+
+	/* anything that latched meanwhile is covered by the step taken */
+	power_update_bits(HW_POWER_CTRL, bo->irq_bit, 0);
+	power_update_bits(HW_POWER_CTRL, bo->en_bit, bo->en_bit);
+	return IRQ_HANDLED;
+}
+
+static void power_bo_init(void)
+{
+	struct power_bo_irq *bo;
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(power_bo_irqs); i++) {
+		bo = &power_bo_irqs[i];
+		INIT_DELAYED_WORK(&bo->dcdc->bo_decay_work, power_bo_decay);
+		ret = request_threaded_irq(bo->irq, power_bo_irq,
+					   power_bo_thread, 0,
+					   bo->dcdc->sreg.rdata->name, bo);
+		if (ret) {
+			pr_err("%s: brownout irq %d: %d\n",
+			       bo->dcdc->sreg.rdata->name, bo->irq, ret);
+			continue;
+		}
+		power_update_bits(HW_POWER_CTRL, bo->irq_bit, 0);
+		power_update_bits(HW_POWER_CTRL, bo->en_bit, bo->en_bit);
+	}
+}
+
+/*
+ * debugfs mxs-power/brownout: interrupts and steps taken per rail.
+ * Writing anything drops the steps again, once the cause is fixed.
+ */
+static int power_bo_show(struct seq_file *s, void *unused)
+{
+	struct power_bo_irq *bo;
+	int i;
+
+	seq_printf(s, "%-8s %8s %8s %8s %16s\n", "rail", "events", "bumps",
+		   "held", "last ns");
+	for (i = 0; i < ARRAY_SIZE(power_bo_irqs); i++) {
+		bo = &power_bo_irqs[i];
+		seq_printf(s, "%-8s %8u %8u %8d %16llu\n",
+			   bo->dcdc->sreg.rdata->name, bo->events, bo->bumps,
+			   bo->dcdc->bo_bump, (unsigned long long)bo->last_ns);
 	}
-};
+	seq_printf(s, "budget limit %d uA, clamped %u times\n",
+		   ACCESS_ONCE(power_budget_limit), power_budget_clamps);
+	return 0;
+}
 
+static int power_bo_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, power_bo_show, inode->i_private);
+}
 
-static struct regulator_init_data vdda_init = {
-	.constraints = {
-		.name			= "vdda",
-		.min_uV			= 1500000,
-		.max_uV			= 2275000,
-		.valid_modes_mask	= REGULATOR_MODE_FAST |
-					  REGULATOR_MODE_NORMAL,
-		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
-					  REGULATOR_CHANGE_MODE,
-		.input_uV		= 5000000,
-		.always_on		= 1,
+static ssize_t power_bo_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct mxs_dcdc_regulator *dcdc;
+	unsigned long flags;
+	int i, code, bump;
+
+	for (i = 0; i < ARRAY_SIZE(power_bo_irqs); i++) {
+		dcdc = power_bo_irqs[i].dcdc;
+		cancel_delayed_work_sync(&dcdc->bo_decay_work);
+		mutex_lock(&dcdc->lock);
+		spin_lock_irqsave(&dcdc->ramp_lock, flags);
+		bump = dcdc->bo_bump;
+		dcdc->bo_bump = 0;
+		spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+		if (bump) {
+			code = power_loadline_code(dcdc, dcdc->base_code);
+			power_dcdc_write(dcdc, code, code);
+		}
+		mutex_unlock(&dcdc->lock);
 	}
+	return count;
+}
+
+static const struct file_operations power_bo_fops = {
+	.open		= power_bo_open,
+	.read		= seq_read,
+	.write		= power_bo_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
 };
 
+/* debugfs mxs-power/settle: the settle model and its effect per rail */
+static int power_settle_show(struct seq_file *s, void *unused)
+{
+	struct mxs_dcdc_regulator *dcdc;
+	int i;
 
-static struct regulator_init_data vddio_init = {
-	.constraints = {
-		.name			= "vddio",
-		.min_uV			= 2800000 + MX28EVK_VDDIO_OFFSET,
-		.max_uV			= 3600000 + MX28EVK_VDDIO_OFFSET,
-		.valid_modes_mask	= REGULATOR_MODE_FAST |
-					  REGULATOR_MODE_NORMAL,
-		.valid_ops_mask		= REGULATOR_CHANGE_VOLTAGE |
-					  REGULATOR_CHANGE_MODE,
-		.input_uV		= 5000000,
-		.always_on		= 1,
+	seq_printf(s, "%-8s %10s %10s %10s %10s\n", "rail", "ns/step",
+		   "changes", "slept us", "polled us");
+	for (i = 0; i < ARRAY_SIZE(mx28evk_rails); i++) {
+		if (mx28evk_rails[i].ops != &dcdc_rops)
+			continue;
+		dcdc = to_dcdc(mx28evk_rails[i].sreg);
+		seq_printf(s, "%-8s %10u %10u %10u %10u\n",
+			   dcdc->sreg.rdata->name, dcdc->settle_ns_per_step,
+			   dcdc->transitions, dcdc->slept_us, dcdc->polled_us);
 	}
+	return 0;
+}
+
+static int power_settle_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, power_settle_show, inode->i_private);
+}
+
+static const struct file_operations power_settle_fops = {
+	.open		= power_settle_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
 };
 
-static int vbus5v_enable(struct mxs_regulator *sreg)
+/*
+ * debugfs mxs-power/ramp/: step size and pace of each DC-DC rail,
+ * mxs-power/downscale/: the decrease delay and what it saved
+ */
+static int power_ramp_step_us_get(void *data, u64 *val)
 {
-	gpio_set_value(USB_POWER_ENABLE, 1);
+	struct mxs_dcdc_regulator *dcdc = data;
+
+	*val = dcdc->ramp_step_us;
 	return 0;
 }
 
-static int vbus5v_disable(struct mxs_regulator *sreg)
+/* a ramp keeps the period it began with, but 0 is refused while one runs */
+static int power_ramp_step_us_set(void *data, u64 val)
 {
-	gpio_set_value(USB_POWER_ENABLE, 0);
-	return 0;
+	struct mxs_dcdc_regulator *dcdc = data;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&dcdc->ramp_lock, flags);
+	if (!val && dcdc->ramping)
+		ret = -EBUSY;
+	else
+		dcdc->ramp_step_us = val;
+	spin_unlock_irqrestore(&dcdc->ramp_lock, flags);
+
+	return ret;
 }
 
-static int vbus5v_is_enabled(struct mxs_regulator *sreg)
+DEFINE_SIMPLE_ATTRIBUTE(power_ramp_step_us_fops, power_ramp_step_us_get,
+			power_ramp_step_us_set, "%llu\n");
+
+static void power_dcdc_debugfs(struct dentry *parent)
 {
-	return gpio_get_value(USB_POWER_ENABLE);
+	struct mxs_dcdc_regulator *dcdc;
+	struct dentry *dir, *down;
+	char name[32];
+	int i;
+
+	dir = debugfs_create_dir("ramp", parent);
+	down = debugfs_create_dir("downscale", parent);
+	if (IS_ERR_OR_NULL(dir) || IS_ERR_OR_NULL(down))
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(mx28evk_rails); i++) {
+		if (mx28evk_rails[i].ops != &dcdc_rops)
+			continue;
+		dcdc = to_dcdc(mx28evk_rails[i].sreg);
+		snprintf(name, sizeof(name), "%s_step",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_u32(name, S_IRUGO | S_IWUSR, dir,
+				   &dcdc->ramp_step);
+		snprintf(name, sizeof(name), "%s_step_us",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_file(name, S_IRUGO | S_IWUSR, dir, dcdc,
+				    &power_ramp_step_us_fops);
+		snprintf(name, sizeof(name), "%s_ramps",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_u32(name, S_IRUGO, dir, &dcdc->ramps);
+		snprintf(name, sizeof(name), "%s_aborts",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_u32(name, S_IRUGO, dir, &dcdc->ramp_aborts);
+
+		snprintf(name, sizeof(name), "%s_delay_ms",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_u32(name, S_IRUGO | S_IWUSR, down,
+				   &dcdc->down_delay_ms);
+		snprintf(name, sizeof(name), "%s_deferred",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_u32(name, S_IRUGO, down, &dcdc->down_deferred);
+		snprintf(name, sizeof(name), "%s_applied",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_u32(name, S_IRUGO, down, &dcdc->down_applied);
+		snprintf(name, sizeof(name), "%s_avoided",
+			 dcdc->sreg.rdata->name);
+		debugfs_create_u32(name, S_IRUGO, down, &dcdc->down_avoided);
+	}
 }
 
+/* one debugfs bench, stress or replay run at a time */
+static DEFINE_MUTEX(bench_lock);
 
-static struct mxs_platform_regulator_data vbus5v_data = {
-	.name		= "vbus5v",
-	.enable		= vbus5v_enable,
-	.disable	= vbus5v_disable,
-	.is_enabled	= vbus5v_is_enabled,
+#ifdef CONFIG_MXS_POWER_SIM
+/*
+ * debugfs mxs-power/bench, built with the POWER model only: writing to
+ * it drives every operation of every rail bench_iterations times
+ * through the consumer API, reading it returns the report of the last
+ * run with throughput, latency percentiles and POWER register accesses
+ * per call. Set operations write back the value just read, so the
+ * rails are left as they were.
+ */
+enum {
+	BENCH_GET_VOLTAGE,
+	BENCH_SET_VOLTAGE,
+	BENCH_GET_CURRENT,
+	BENCH_SET_CURRENT,
+	BENCH_GET_MODE,
+	BENCH_SET_MODE,
+	BENCH_NUM_OPS,
 };
 
-static struct regulator_init_data vbus5v_init = {
-	.constraints = {
-		.name			= "vbus5v",
-		.valid_ops_mask		= REGULATOR_CHANGE_STATUS,
-	}
+static const char *bench_op_names[BENCH_NUM_OPS] = {
+	"get_voltage", "set_voltage", "get_current", "set_current",
+	"get_mode", "set_mode",
 };
 
+#define BENCH_MAX_ITERATIONS	100000
+#define BENCH_REPORT_LEN	(16 * 1024)
 
-/* now the current regulators */
-/* Restriction: .... no set_current call on root regulator */
-static int main_add_current(struct mxs_regulator *sreg,
-			    int uA)
+static u32 bench_iterations = 10000;
+static char *bench_report;
+static size_t bench_report_len;
+
+static int bench_call(struct regulator *reg, int op, int val)
 {
+	switch (op) {
+	case BENCH_GET_VOLTAGE:
+		return regulator_get_voltage(reg);
+	case BENCH_SET_VOLTAGE:
+		return regulator_set_voltage(reg, val, val);
+	case BENCH_GET_CURRENT:
+		return regulator_get_current_limit(reg);
+	case BENCH_SET_CURRENT:
+		return regulator_set_current_limit(reg, val, val);
+	case BENCH_GET_MODE:
+		return regulator_get_mode(reg);
+	case BENCH_SET_MODE:
+		return regulator_set_mode(reg, val);
+	}
+	return -EINVAL;
+}
 
-	pr_debug("%s: enter reg %s, uA=%d\n",
-		 __func__, sreg->regulator.name, uA);
-	if (uA > 0 && (sreg->cur_current + uA > sreg->rdata->max_current))
-		return -EINVAL;
-	else
-		sreg->cur_current += uA;
+/* what a set operation writes back, < 0 if the rail can't be read */
+static int bench_value(struct regulator *reg, int op)
+{
+	switch (op) {
+	case BENCH_SET_VOLTAGE:
+		return regulator_get_voltage(reg);
+	case BENCH_SET_CURRENT:
+		return regulator_get_current_limit(reg);
+	case BENCH_SET_MODE:
+		return regulator_get_mode(reg);
+	}
 	return 0;
 }
 
-static int cur_reg_set_current(struct mxs_regulator *sreg, int uA)
+static int bench_cmp(const void *a, const void *b)
 {
-	int ret = 0;
-	unsigned long flags;
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
 
-	pr_debug("%s: enter reg %s, uA=%d\n",
-		 __func__, sreg->regulator.name, uA);
+	return x < y ? -1 : x > y;
+}
 
-	if (sreg->parent) {
-		spin_lock_irqsave(&sreg->parent->lock, flags);
-		ret = main_add_current(sreg->parent, uA - sreg->cur_current);
-		spin_unlock_irqrestore(&sreg->parent->lock, flags);
+static size_t bench_rail(char *buf, size_t len, const char *name, int root,
+			 u32 *samples, u32 n)
+{
+	struct regulator *reg;
+	u32 reads, writes, i;
+	u64 total, rd, wr;
+	size_t pos = 0;
+	ktime_t t;
+	int op, val;
+
+	reg = regulator_get(NULL, name);
+	if (IS_ERR(reg))
+		return 0;
+
+	for (op = 0; op < BENCH_NUM_OPS; op++) {
+		/* no set_current call on the root regulator */
+		if (root && op == BENCH_SET_CURRENT)
+			continue;
+		/* ops the rail lacks or its constraints forbid fail here */
+		val = bench_value(reg, op);
+		if (val < 0 || bench_call(reg, op, val) < 0)
+			continue;
+
+		reads = power_mmio_reads;
+		writes = power_mmio_writes;
+		total = 0;
+		for (i = 0; i < n; i++) {
+			t = ktime_get();
+			bench_call(reg, op, val);
+			samples[i] = ktime_to_ns(ktime_sub(ktime_get(), t));
+			total += samples[i];
+		}
+		reads = power_mmio_reads - reads;
+		writes = power_mmio_writes - writes;
+
+		/* accesses per call in hundredths */
+		rd = div_u64((u64)reads * 100, n);
+		wr = div_u64((u64)writes * 100, n);
+
+		sort(samples, n, sizeof(*samples), bench_cmp, NULL);
+		pos += scnprintf(buf + pos, len - pos,
+			"%-16s %-12s %9llu %7u %7u %7u %4llu.%02llu %4llu.%02llu\n",
+			name, bench_op_names[op],
+			total ? div64_u64((u64)n * NSEC_PER_SEC, total) : 0,
+			samples[n / 2], samples[n * 99 / 100],
+			samples[n * 999 / 1000],
+			div_u64(rd, 100), rd - div_u64(rd, 100) * 100,
+			div_u64(wr, 100), wr - div_u64(wr, 100) * 100);
 	}
 
+	regulator_put(reg);
+	return pos;
+}
 
-	if ((!ret) || (!sreg->parent))
-		goto out;
+static ssize_t power_bench_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	u32 n = clamp_t(u32, bench_iterations, 1, BENCH_MAX_ITERATIONS);
+	struct mxs_regulator_rail *rail;
+	char name[80];
+	char *report;
+	u32 *samples;
+	size_t pos;
+	int i;
 
-	if (sreg->mode == REGULATOR_MODE_FAST)
-		return ret;
+	samples = vmalloc(n * sizeof(*samples));
+	report = vmalloc(BENCH_REPORT_LEN);
+	if (!samples || !report) {
+		vfree(samples);
+		vfree(report);
+		return -ENOMEM;
+	}
 
-	while (ret) {
-		wait_event(sreg->parent->wait_q ,
-			   (uA - sreg->cur_current <
-			    sreg->parent->rdata->max_current -
-			    sreg->parent->cur_current));
-		spin_lock_irqsave(&sreg->parent->lock, flags);
-		ret = main_add_current(sreg->parent, uA - sreg->cur_current);
-		spin_unlock_irqrestore(&sreg->parent->lock, flags);
+	mutex_lock(&bench_lock);
+	pos = scnprintf(report, BENCH_REPORT_LEN,
+			"%-16s %-12s %9s %7s %7s %7s %7s %7s\n", "rail", "op",
+			"ops/s", "p50 ns", "p99 ns", "p999 ns", "rd/op", "wr/op");
+	for (i = 0; i < ARRAY_SIZE(mx28evk_rails); i++) {
+		rail = &mx28evk_rails[i];
+		pos += bench_rail(report + pos, BENCH_REPORT_LEN - pos,
+				  rail->sreg->rdata->name,
+				  rail->id == MXS_OVERALL_CUR, samples, n);
 	}
-out:
-	if (sreg->parent && (uA - sreg->cur_current < 0))
-		wake_up_all(&sreg->parent->wait_q);
-	sreg->cur_current = uA;
-	return 0;
+	for (i = 0; !power_sibling_name(i, name, sizeof(name)); i++)
+		pos += bench_rail(report + pos, BENCH_REPORT_LEN - pos, name,
+				  0, samples, n);
 
-}
+	vfree(bench_report);
+	bench_report = report;
+	bench_report_len = pos;
+	mutex_unlock(&bench_lock);
 
-static int cur_reg_get_current(struct mxs_regulator *sreg)
-{
-	return sreg->cur_current;
+	vfree(samples);
+	return count;
 }
 
-static int enable_cur_reg(struct mxs_regulator *sreg)
+static ssize_t power_bench_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
 {
-	/* XXX: TODO */
-	return 0;
+	ssize_t ret;
+
+	mutex_lock(&bench_lock);
+	ret = simple_read_from_buffer(buf, count, ppos, bench_report,
+				      bench_report_len);
+	mutex_unlock(&bench_lock);
+	return ret;
 }
 
-static int disable_cur_reg(struct mxs_regulator *sreg)
+static const struct file_operations power_bench_fops = {
+	.read		= power_bench_read,
+	.write		= power_bench_write,
+};
+#endif
+
+/*
+ * debugfs mxs-power/stress: reading it lets stress_threads simulated
+ * siblings hammer the current allocator for stress_duration_ms with
+ * random requests against a private parent of stress_budget_uA, then
+ * reports grants/s, the wait time distribution, the Jain fairness
+ * index over the grants per sibling and how often a request waited
+ * longer than stress_starve_ms. overall_current is not touched.
+ */
+#define STRESS_HIST_BUCKETS	32
+#define STRESS_MAX_DURATION_MS	60000
+
+struct stress_worker {
+	struct mxs_sibling_regulator sib;
+	struct task_struct *task;
+	u32 grants;
+	u32 starved;
+	u32 hist[STRESS_HIST_BUCKETS];
+};
+
+static u32 stress_threads = 32;
+static u32 stress_budget_uA = 1000000;
+static u32 stress_duration_ms = 1000;
+static u32 stress_starve_ms = 100;
+
+static struct mxs_platform_regulator_data stress_root_data = {
+	.name		= "stress_root",
+};
+static struct mxs_regulator stress_root = {
+	.regulator.name	= "stress_root",
+	.rdata		= &stress_root_data,
+};
+static int stress_stopping;
+static u32 stress_max_uA;
+
+static int stress_thread(void *data)
 {
-	/* XXX: TODO */
+	struct stress_worker *w = data;
+	u32 max_uA = stress_max_uA;
+	u32 wait_us;
+	ktime_t t;
+
+	while (!kthread_should_stop() && !ACCESS_ONCE(stress_stopping)) {
+		t = ktime_get();
+		cur_reg_set_current(&w->sib.sreg, random32() % max_uA);
+		wait_us = ktime_us_delta(ktime_get(), t);
+
+		w->grants++;
+		w->hist[wait_us ? min(fls(wait_us), STRESS_HIST_BUCKETS - 1)
+			 : 0]++;
+		if (wait_us > stress_starve_ms * USEC_PER_MSEC)
+			w->starved++;
+
+		/* hold the grant for a moment */
+		usleep_range(10, 100);
+	}
+
+	cur_reg_set_current(&w->sib.sreg, 0);
+	while (!kthread_should_stop())
+		msleep(1);
 	return 0;
 }
 
-static int cur_reg_is_enabled(struct mxs_regulator *sreg)
+static void stress_report(struct seq_file *s, struct stress_worker *w, u32 n,
+			  u32 ms)
 {
-	/* XXX: TODO */
-	return 1;
+	u32 hist[STRESS_HIST_BUCKETS] = { 0 };
+	u64 grants = 0, sum_sq = 0, jain;
+	u32 starved = 0, seen, p;
+	static const u32 pct[] = { 50, 90, 99, 100 };
+	int i, b;
+
+	for (i = 0; i < n; i++) {
+		grants += w[i].grants;
+		sum_sq += (u64)w[i].grants * w[i].grants;
+		starved += w[i].starved;
+		for (b = 0; b < STRESS_HIST_BUCKETS; b++)
+			hist[b] += w[i].hist[b];
+	}
+
+	/* (sum x)^2 / (n * sum x^2), in thousandths */
+	jain = sum_sq ? div64_u64(grants * grants * 1000, sum_sq * n) : 0;
+
+	seq_printf(s, "siblings %u budget %u uA duration %u ms\n",
+		   n, stress_budget_uA, ms);
+	seq_printf(s, "grants/s %llu\n", div_u64(grants * MSEC_PER_SEC, ms));
+	seq_printf(s, "fairness (jain) %llu.%03llu\n",
+		   div_u64(jain, 1000), jain - div_u64(jain, 1000) * 1000);
+	seq_printf(s, "starved (> %u ms) %u\n", stress_starve_ms, starved);
+
+	for (i = 0; i < ARRAY_SIZE(pct); i++) {
+		seen = 0;
+		for (b = 0; b < STRESS_HIST_BUCKETS; b++) {
+			seen += hist[b];
+			if ((u64)seen * 100 >= grants * pct[i])
+				break;
+		}
+		p = b ? 1 << min(b, 31) : 1;
+		seq_printf(s, "wait p%u < %u us\n", pct[i], p);
+	}
 }
 
-static int cur_reg_set_mode(struct mxs_regulator *sreg, int mode)
+static int power_stress_show(struct seq_file *s, void *unused)
 {
-	int ret = 0;
+	struct stress_worker *w;
+	u32 n = clamp_t(u32, stress_threads, 1, 1024);
+	u32 ms = clamp_t(u32, stress_duration_ms, 1, STRESS_MAX_DURATION_MS);
+	int i, ret = 0;
+
+	w = vmalloc(n * sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+	memset(w, 0, n * sizeof(*w));
+
+	mutex_lock(&bench_lock);
+	stress_root_data.max_current = stress_budget_uA;
+	stress_root.cur_current = 0;
+	spin_lock_init(&stress_root.lock);
+	init_waitqueue_head(&stress_root.wait_q);
+	stress_stopping = 0;
+	stress_max_uA = max_t(u32, stress_budget_uA / n * 2, 1);
+
+	for (i = 0; i < n; i++) {
+		struct mxs_sibling_regulator *sib = &w[i].sib;
+
+		snprintf(sib->rdata.name, sizeof(sib->rdata.name),
+			 "stress-%d", i + 1);
+		sib->sreg.regulator.name = sib->rdata.name;
+		sib->sreg.rdata = &sib->rdata;
+		sib->sreg.parent = &stress_root;
+		sib->sreg.mode = REGULATOR_MODE_NORMAL;
+		spin_lock_init(&sib->sreg.lock);
+		sib->enabled = 1;
+		INIT_DELAYED_WORK(&sib->release_work, cur_reg_release_work);
+		INIT_WORK(&sib->acquire_work, cur_reg_acquire_work);
+	}
 
-	switch (mode) {
-	case REGULATOR_MODE_NORMAL:
-	case REGULATOR_MODE_FAST:
-		sreg->mode = mode;
-		break;
-	default:
-		ret = -EINVAL;
-		break;
+	for (i = 0; i < n; i++) {
+		w[i].task = kthread_run(stress_thread, &w[i], "mxs-stress/%d",
+					i);
+		if (IS_ERR(w[i].task)) {
+			ret = PTR_ERR(w[i].task);
+			w[i].task = NULL;
+			break;
+		}
 	}
+
+	if (!ret)
+		msleep(ms);
+
+	/* let every blocked request through so the threads can stop */
+	stress_stopping = 1;
+	spin_lock_irq(&stress_root.lock);
+	stress_root_data.max_current = INT_MAX / 2;
+	spin_unlock_irq(&stress_root.lock);
+	wake_up_all(&stress_root.wait_q);
+	for (i = 0; i < n; i++)
+		if (w[i].task)
+			kthread_stop(w[i].task);
+
+	if (!ret)
+		stress_report(s, w, n, ms);
+	mutex_unlock(&bench_lock);
+
+	vfree(w);
 	return ret;
 }
 
-static int cur_reg_get_mode(struct mxs_regulator *sreg)
+static int power_stress_open(struct inode *inode, struct file *file)
 {
-	return sreg->mode;
+	return single_open(file, power_stress_show, inode->i_private);
 }
 
-static struct mxs_platform_regulator_data overall_cur_data = {
-	.name		= "overall_current",
-	.set_current	= cur_reg_set_current,
-	.get_current	= cur_reg_get_current,
-	.enable		= enable_cur_reg,
-	.disable	= disable_cur_reg,
-	.is_enabled	= cur_reg_is_enabled,
-	.set_mode	= cur_reg_set_mode,
-	.get_mode	= cur_reg_get_mode,
-	.max_current	= 0x7fffffff,
+static const struct file_operations power_stress_fops = {
+	.open		= power_stress_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
 };
 
-static struct regulator_init_data overall_cur_init = {
-	.constraints = {
-		.name			= "overall_current",
-		.valid_modes_mask	= REGULATOR_MODE_NORMAL |
-					  REGULATOR_MODE_FAST,
-		.valid_ops_mask		= REGULATOR_CHANGE_CURRENT |
-					  REGULATOR_CHANGE_MODE,
-		.max_uA                 = 0x7fffffff,
-		.min_uA                 = 0x0,
-		.always_on		= 1,
+/*
+ * debugfs mxs-power/replay: records written here, in the format of
+ * mxs-power/trace, are issued again in order through the consumer API,
+ * with one regulator handle per rail for the whole session. With
+ * replay_timed set the recorded gaps between requests are kept,
+ * otherwise they go back to back. Reading it reports the last replay;
+ * with trace_enable set the replay itself is traced for comparison.
+ * Enables still outstanding when the file is closed are undone, a
+ * disable is only replayed against an enable of the same session.
+ * Siblings must not be removed while a replay is open.
+ */
+#define REPLAY_MAX_RAILS	32
+
+static u32 replay_timed;
+static int replay_active;
+
+static struct {
+	u32 records;
+	u32 unknown;
+	u32 skipped;
+	u32 failed;
+	u32 mismatched;
+	u64 total_ns;
+	u32 max_ns;
+	u32 reads;
+	u32 writes;
+} replay_stats;
+
+static struct power_trace_rec replay_carry;
+static size_t replay_carry_len;
+static u64 replay_ts0;
+static u64 replay_start;
+
+static struct replay_reg {
+	int id;
+	struct regulator *reg;
+	int enables;
+} replay_regs[REPLAY_MAX_RAILS];
+static int replay_nregs;
+
+/* copy the name of rail id, to look it up without the lock */
+static int power_rail_name(int id, char *name, size_t len)
+{
+	struct mxs_sibling_group *group;
+	int i, ret = -ENODEV;
+
+	for (i = 0; i < ARRAY_SIZE(mx28evk_rails); i++)
+		if (mx28evk_rails[i].id == id) {
+			strlcpy(name, mx28evk_rails[i].sreg->rdata->name, len);
+			return 0;
+		}
+
+	mutex_lock(&sibling_list_lock);
+	list_for_each_entry(group, &sibling_groups, node)
+		for (i = 0; i < group->count; i++)
+			if (group->sib[i].rail.id == id) {
+				strlcpy(name, group->sib[i].rdata.name, len);
+				ret = 0;
+			}
+	mutex_unlock(&sibling_list_lock);
+
+	return ret;
+}
+
+/* the session's handle on rail id, taken on first use */
+static struct replay_reg *power_replay_reg(int id)
+{
+	struct regulator *reg;
+	char name[80];
+	int i;
+
+	for (i = 0; i < replay_nregs; i++)
+		if (replay_regs[i].id == id)
+			return &replay_regs[i];
+
+	if (replay_nregs == REPLAY_MAX_RAILS ||
+	    power_rail_name(id, name, sizeof(name)))
+		return NULL;
+	reg = regulator_get(NULL, name);
+	if (IS_ERR(reg))
+		return NULL;
+
+	replay_regs[replay_nregs].id = id;
+	replay_regs[replay_nregs].reg = reg;
+	replay_regs[replay_nregs].enables = 0;
+	return &replay_regs[replay_nregs++];
+}
+
+static int power_replay_call(struct replay_reg *r,
+			     const struct power_trace_rec *rec)
+{
+	int ret;
+
+	switch (rec->op) {
+	case POWER_TRACE_SET_VOLTAGE:
+		return regulator_set_voltage(r->reg, rec->min_val, rec->val);
+	case POWER_TRACE_SET_CURRENT:
+		return regulator_set_current_limit(r->reg, rec->min_val,
+						   rec->val);
+	case POWER_TRACE_ENABLE:
+		ret = regulator_enable(r->reg);
+		if (!ret)
+			r->enables++;
+		return ret;
+	case POWER_TRACE_DISABLE:
+		ret = regulator_disable(r->reg);
+		if (!ret)
+			r->enables--;
+		return ret;
+	case POWER_TRACE_SET_MODE:
+		return regulator_set_mode(r->reg, rec->val);
 	}
-};
+	return -ENOTSUPP;
+}
 
-static struct mxs_platform_regulator_data sibling_cur_data = {
-	.parent_name	= "overall_current",
-	.set_current	= cur_reg_set_current,
-	.get_current	= cur_reg_get_current,
-	.enable		= enable_cur_reg,
-	.disable	= disable_cur_reg,
-	.is_enabled	= cur_reg_is_enabled,
-	.set_mode	= cur_reg_set_mode,
-	.get_mode	= cur_reg_get_mode,
-};
+static void power_replay_one(const struct power_trace_rec *rec)
+{
+	struct replay_reg *r;
+	s64 wait_us;
+	u32 ns;
+	ktime_t t;
+	int ret;
+
+	if (!replay_stats.records++)
+		replay_ts0 = rec->ts_ns;
+
+	if (replay_timed) {
+		wait_us = div_s64((s64)(rec->ts_ns - replay_ts0) -
+				  (s64)(power_now_ns() - replay_start),
+				  NSEC_PER_USEC);
+		if (wait_us > 0)
+			power_sleep_us(wait_us);
+	}
 
+	r = power_replay_reg(rec->rail);
+	if (!r) {
+		replay_stats.unknown++;
+		return;
+	}
+	/* never drop an enable some other consumer holds */
+	if (rec->op == POWER_TRACE_DISABLE && !r->enables) {
+		replay_stats.skipped++;
+		return;
+	}
 
-static const char *device_names[] = {
-	"mxs-duart", "mxs-bl", "mxs-i2c"
-};
+	t = ktime_get();
+	ret = power_replay_call(r, rec);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), t));
 
-static int sibling_current_devices_num;
+	replay_stats.total_ns += ns;
+	replay_stats.max_ns = max(replay_stats.max_ns, ns);
+	if (ret)
+		replay_stats.failed++;
+	if (clamp(ret, -128, 127) != rec->ret)
+		replay_stats.mismatched++;
+}
 
-int mxs_platform_add_regulator(const char *name, int count)
+/* one writer at a time, which owns the replay state until release */
+static int power_replay_open(struct inode *inode, struct file *file)
 {
-	int i;
-	pr_debug("%s: name %s, count %d\n", __func__, name, count);
-	for (i = sibling_current_devices_num;
-	     i < sibling_current_devices_num + count;
-	     i++) {
-		struct regulator_init_data *sibling_init =
-			kzalloc(sizeof(struct regulator_init_data),
-			GFP_KERNEL);
-		struct mxs_regulator *curr_reg =
-			kzalloc(sizeof(struct mxs_regulator),
-			GFP_KERNEL);
-		struct mxs_platform_regulator_data *d =
-			kzalloc(sizeof(struct mxs_platform_regulator_data),
-			GFP_KERNEL);
-		if (!d || !curr_reg || !sibling_init)
-			return -ENOMEM;
+	int ret = 0;
 
-		sibling_init->constraints.valid_modes_mask =
-			REGULATOR_MODE_NORMAL | REGULATOR_MODE_FAST;
-		sibling_init->constraints.valid_ops_mask =
-			REGULATOR_CHANGE_CURRENT | REGULATOR_CHANGE_MODE;
-		sibling_init->constraints.max_uA = 0x7fffffff;
-		sibling_init->constraints.min_uA = 0x0;
+	if (!(file->f_mode & FMODE_WRITE))
+		return 0;
+
+	mutex_lock(&bench_lock);
+	if (replay_active) {
+		ret = -EBUSY;
+	} else {
+		replay_active = 1;
+		memset(&replay_stats, 0, sizeof(replay_stats));
+		replay_stats.reads = power_mmio_reads;
+		replay_stats.writes = power_mmio_writes;
+		replay_carry_len = 0;
+		replay_nregs = 0;
+		replay_start = power_now_ns();
+	}
+	mutex_unlock(&bench_lock);
+	return ret;
+}
 
-		memcpy(d, &sibling_cur_data, sizeof(sibling_cur_data));
-		d->parent_name = kstrdup(sibling_cur_data.parent_name,
-					 GFP_KERNEL);
-		snprintf(d->name, 80, "%s-%d",
-			 name, i - sibling_current_devices_num + 1);
-		sibling_init->constraints.name = kstrdup(d->name, GFP_KERNEL);
-		sibling_init->constraints.always_on = 1;
-		curr_reg->rdata = d;
-		mxs_register_regulator(curr_reg, 101 + i, sibling_init);
+/* no lock is held across the calls, they may wait for budget */
+static ssize_t power_replay_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct power_trace_rec rec;
+	size_t done = 0, n;
+
+	while (done < count) {
+		/* records may straddle two writes */
+		n = min(count - done, sizeof(rec) - replay_carry_len);
+		if (copy_from_user((u8 *)&replay_carry + replay_carry_len,
+				   buf + done, n)) {
+			done = done ? done : -EFAULT;
+			break;
+		}
+		done += n;
+		replay_carry_len += n;
+		if (replay_carry_len < sizeof(rec))
+			break;
+
+		rec = replay_carry;
+		replay_carry_len = 0;
+		power_replay_one(&rec);
 	}
-	sibling_current_devices_num += count;
-	return 0;
+
+	*ppos += done;
+	return done;
 }
 
-static struct mxs_regulator vddd_reg = {
-		.rdata = &vddd_data,
-};
+static ssize_t power_replay_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	char tmp[256];
+	int len;
+
+	mutex_lock(&bench_lock);
+	len = snprintf(tmp, sizeof(tmp),
+		       "records %u\nunknown %u\nskipped %u\nfailed %u\n"
+		       "mismatched %u\ntotal_ns %llu\nmax_ns %u\nreads %u\n"
+		       "writes %u\n",
+		       replay_stats.records, replay_stats.unknown,
+		       replay_stats.skipped, replay_stats.failed,
+		       replay_stats.mismatched, replay_stats.total_ns,
+		       replay_stats.max_ns, replay_stats.reads,
+		       replay_stats.writes);
+	mutex_unlock(&bench_lock);
+
+	return simple_read_from_buffer(buf, count, ppos, tmp, len);
+}
 
-static struct mxs_regulator vdda_reg = {
-		.rdata = &vdda_data,
-};
+static int power_replay_release(struct inode *inode, struct file *file)
+{
+	struct replay_reg *r;
+	int i;
 
-static struct mxs_regulator vddio_reg = {
-		.rdata = &vddio_data,
-};
+	if (!(file->f_mode & FMODE_WRITE))
+		return 0;
 
-static struct mxs_regulator vdddbo_reg = {
-		.rdata = &vdddbo_data,
-};
+	for (i = 0; i < replay_nregs; i++) {
+		r = &replay_regs[i];
+		while (r->enables-- > 0)
+			regulator_disable(r->reg);
+		regulator_put(r->reg);
+	}
 
-static struct mxs_regulator overall_cur_reg = {
-		.rdata = &overall_cur_data,
-};
+	mutex_lock(&bench_lock);
+	replay_nregs = 0;
+	replay_stats.reads = power_mmio_reads - replay_stats.reads;
+	replay_stats.writes = power_mmio_writes - replay_stats.writes;
+	replay_active = 0;
+	mutex_unlock(&bench_lock);
+	return 0;
+}
 
-static struct mxs_regulator vbus5v_reg = {
-		.rdata = &vbus5v_data,
+static const struct file_operations power_replay_fops = {
+	.open		= power_replay_open,
+	.read		= power_replay_read,
+	.write		= power_replay_write,
+	.release	= power_replay_release,
 };
 
 static int __init regulators_init(void)
 {
 	int i;
 	int retval = 0;
-	u32 vddio = __raw_readl(REGS_POWER_BASE + HW_POWER_VDDIOCTRL) & ~0x1f;
 	pr_debug("regulators_init \n");
-	__raw_writel(vddio | 0xA, REGS_POWER_BASE + HW_POWER_VDDIOCTRL);
-	vdddbo_reg.parent = &vddd_reg;
-	mxs_register_regulator(&vddd_reg, MXS_VDDD, &vddd_init);
-	mxs_register_regulator(&vdddbo_reg, MXS_VDDDBO, &vdddbo_init);
-	mxs_register_regulator(&vdda_reg, MXS_VDDA, &vdda_init);
-	mxs_register_regulator(&vddio_reg, MXS_VDDIO, &vddio_init);
-	mxs_register_regulator(&overall_cur_reg,
-		MXS_OVERALL_CUR, &overall_cur_init);
-
-	mxs_register_regulator(&vbus5v_reg, MX28EVK_VBUS5v, &vbus5v_init);
+	power_update_bits(HW_POWER_VDDIOCTRL, 0x1f, 0xA);
+	power_dcdc_init(&vddd_reg);
+	power_dcdc_init(&vdda_reg);
+	power_dcdc_init(&vddio_reg);
+	vdddbo_reg.parent = &vddd_reg.sreg;
+	retval = mxs_register_regulators(mx28evk_rails,
+					 ARRAY_SIZE(mx28evk_rails));
+	if (retval)
+		return retval;
 
 	for (i = 0; i < ARRAY_SIZE(device_names); i++) {
 		retval = mxs_platform_add_regulator(device_names[i], 1);
@@ -576,7 +3892,76 @@ static int __init regulators_init(void)
 	mxs_platform_add_regulator("charger", 1);
 	mxs_platform_add_regulator("power-test", 1);
 	mxs_platform_add_regulator("cpufreq", 1);
+	mxs_platform_set_current_coalesce("mxs-bl-1", MX28EVK_BL_COALESCE_MS);
+	mxs_platform_set_current_shed("mxs-bl-1", 1);
+	mxs_platform_set_current_shed("charger-1", 1);
+	bus_register_notifier(&platform_bus_type, &power_sibling_nb);
+	power_opp_init();
+	power_speed_init();
+	power_bo_init();
+	power_droop_init();
 	gpio_direction_output(USB_POWER_ENABLE, 0);
+
+	trace_buf = vmalloc(POWER_TRACE_LEN * sizeof(*trace_buf));
+	power_debugfs = debugfs_create_dir("mxs-power", NULL);
+	if (!IS_ERR_OR_NULL(power_debugfs)) {
+		debugfs_create_file("registers", S_IRUGO, power_debugfs, NULL,
+				    &power_regs_fops);
+		debugfs_create_file("settle", S_IRUGO, power_debugfs, NULL,
+				    &power_settle_fops);
+		power_dcdc_debugfs(power_debugfs);
+		debugfs_create_file("opp", S_IRUGO, power_debugfs, NULL,
+				    &power_opp_fops);
+		debugfs_create_file("avs", S_IRUGO, power_debugfs, NULL,
+				    &power_avs_fops);
+		debugfs_create_bool("avs_enable", S_IRUGO | S_IWUSR,
+				    power_debugfs, &power_avs_enable);
+		debugfs_create_file("speed", S_IRUGO, power_debugfs, NULL,
+				    &power_speed_fops);
+		debugfs_create_u32("speed_period_ms", S_IRUGO | S_IWUSR,
+				   power_debugfs, &speed_period_ms);
+		debugfs_create_file("loadline_uv_per_ma", S_IRUGO | S_IWUSR,
+				    power_debugfs, &power_loadline_uv_per_ma,
+				    &power_loadline_fops);
+		debugfs_create_file("loadline_max_uv", S_IRUGO | S_IWUSR,
+				    power_debugfs, &power_loadline_max_uv,
+				    &power_loadline_fops);
+		debugfs_create_u32("loadline_updates", S_IRUGO,
+				   power_debugfs, &vddd_reg.loadline_updates);
+		debugfs_create_file("brownout", S_IRUGO | S_IWUSR,
+				    power_debugfs, NULL, &power_bo_fops);
+		debugfs_create_u32("brownout_hold_ms", S_IRUGO | S_IWUSR,
+				   power_debugfs, &power_bo_hold_ms);
+		debugfs_create_u32("droop_debounce_ms", S_IRUGO | S_IWUSR,
+				   power_debugfs, &power_droop_debounce_ms);
+		debugfs_create_u32("droop_events", S_IRUGO, power_debugfs,
+				   &power_droop_events);
+		debugfs_create_file("stress", S_IRUSR, power_debugfs, NULL,
+				    &power_stress_fops);
+		debugfs_create_u32("stress_threads", S_IRUGO | S_IWUSR,
+				   power_debugfs, &stress_threads);
+		debugfs_create_u32("stress_budget_uA", S_IRUGO | S_IWUSR,
+				   power_debugfs, &stress_budget_uA);
+		debugfs_create_u32("stress_duration_ms", S_IRUGO | S_IWUSR,
+				   power_debugfs, &stress_duration_ms);
+		debugfs_create_u32("stress_starve_ms", S_IRUGO | S_IWUSR,
+				   power_debugfs, &stress_starve_ms);
+		debugfs_create_file("trace", S_IRUGO | S_IWUSR, power_debugfs,
+				    NULL, &power_trace_fops);
+		debugfs_create_bool("trace_enable", S_IRUGO | S_IWUSR,
+				    power_debugfs, &trace_enable);
+		debugfs_create_file("replay", S_IRUGO | S_IWUSR, power_debugfs,
+				    NULL, &power_replay_fops);
+		debugfs_create_bool("replay_timed", S_IRUGO | S_IWUSR,
+				    power_debugfs, &replay_timed);
+#ifdef CONFIG_MXS_POWER_SIM
+		debugfs_create_file("bench", S_IRUSR | S_IWUSR, power_debugfs,
+				    NULL, &power_bench_fops);
+		debugfs_create_u32("bench_iterations", S_IRUGO | S_IWUSR,
+				   power_debugfs, &bench_iterations);
+		mxs_power_sim_debugfs(power_debugfs);
+#endif
+	}
 	return 0;
 }
 postcore_initcall(regulators_init);
@@ -20,6 +20,10 @@
 #include <linux/module.h>
 #include <linux/err.h>
 #include <linux/platform_device.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/ktime.h>
 #include <linux/regulator/machine.h>
 #include <linux/regulator/driver.h>
 #include <mach/power.h>
@@ -192,15 +196,24 @@ static int reg_callback(struct notifier_block *self,
 	return 0;
 }
 
-int mxs_regulator_probe(struct platform_device *pdev)
+/*
+ * All rails hang off the single "mxs_reg" power block device. Rails
+ * registered before it is probed are queued on mxs_rails and
+ * registered by the probe in one pass, later ones (siblings added by
+ * modules) are registered right away.
+ */
+static LIST_HEAD(mxs_rails);
+static DEFINE_MUTEX(mxs_rails_lock);
+static struct platform_device *mxs_power_pdev;
+static struct device *mxs_power_dev;
+
+static int mxs_regulator_add_rail(struct device *dev,
+				  struct mxs_regulator_rail *rail)
 {
 	struct regulator_desc *rdesc;
 	struct regulator_dev *rdev;
-	struct mxs_regulator *sreg;
-	struct regulator_init_data *initdata;
+	struct mxs_regulator *sreg = rail->sreg;
 
-	sreg = platform_get_drvdata(pdev);
-	initdata = pdev->dev.platform_data;
 	sreg->cur_current = 0;
 	sreg->next_current = 0;
 	sreg->cur_voltage = 0;
@@ -208,81 +221,205 @@ int mxs_regulator_probe(struct platform_device *pdev)
 	init_waitqueue_head(&sreg->wait_q);
 	spin_lock_init(&sreg->lock);
 
-	if (pdev->id > MXS_OVERALL_CUR) {
-		rdesc = kzalloc(sizeof(struct regulator_desc), GFP_KERNEL);
-		memcpy(rdesc, &mxs_reg_desc[MXS_OVERALL_CUR],
+	if (rail->id > MXS_OVERALL_CUR || rail->ops) {
+		rdesc = &sreg->regulator;
+		memcpy(rdesc, &mxs_reg_desc[min(rail->id, MXS_OVERALL_CUR)],
 			sizeof(struct regulator_desc));
-		rdesc->name = kstrdup(sreg->rdata->name, GFP_KERNEL);
+		if (rail->id > MXS_OVERALL_CUR) {
+			rdesc->name = sreg->rdata->name;
+			rdesc->id = rail->id;
+		}
+		if (rail->ops)
+			rdesc->ops = rail->ops;
 	} else
-		rdesc = &mxs_reg_desc[pdev->id];
+		rdesc = &mxs_reg_desc[rail->id];
 
 	pr_debug("probing regulator %s %s %d\n",
 			sreg->rdata->name,
 			rdesc->name,
-			pdev->id);
+			rail->id);
 
 	/* register regulator */
-	rdev = regulator_register(rdesc, &pdev->dev,
-				  initdata, sreg);
+	rdev = regulator_register(rdesc, dev, rail->initdata, sreg);
 
 	if (IS_ERR(rdev)) {
-		dev_err(&pdev->dev, "failed to register %s\n",
+		dev_err(dev, "failed to register %s\n",
 			rdesc->name);
 		return PTR_ERR(rdev);
 	}
 
+	/* the 5V source events are delivered on the rail's own chain */
 	if (sreg->rdata->max_current) {
-		struct regulator *regu;
-		regu = regulator_get(NULL, sreg->rdata->name);
 		sreg->nb.notifier_call = reg_callback;
-		regulator_register_notifier(regu, &sreg->nb);
+		blocking_notifier_chain_register(&rdev->notifier, &sreg->nb);
 	}
+	if (rail->nb)
+		blocking_notifier_chain_register(&rdev->notifier, rail->nb);
 
+	rail->rdev = rdev;
+	return 0;
+}
+
+static void mxs_regulator_del_rail(struct mxs_regulator_rail *rail)
+{
+	struct mxs_regulator *sreg = rail->sreg;
+
+	if (!rail->rdev)
+		return;
+
+	/* hand a sibling's budget back to overall_current */
+	if (sreg->parent && sreg->rdata->set_current)
+		sreg->rdata->disable(sreg);
+
+	if (sreg->rdata->max_current)
+		blocking_notifier_chain_unregister(&rail->rdev->notifier,
+						   &sreg->nb);
+	if (rail->nb)
+		blocking_notifier_chain_unregister(&rail->rdev->notifier,
+						   rail->nb);
+	regulator_unregister(rail->rdev);
+	rail->rdev = NULL;
+}
+
+/*
+ * A rail that fails to register is left out, the others still come
+ * up: losing vddio because a sibling clashes is worse than the error.
+ */
+int mxs_regulator_probe(struct platform_device *pdev)
+{
+	struct mxs_regulator_rail *rail;
+	ktime_t start = ktime_get();
+	int num = 0, failed = 0;
+
+	mutex_lock(&mxs_rails_lock);
+	list_for_each_entry(rail, &mxs_rails, node) {
+		num++;
+		if (mxs_regulator_add_rail(&pdev->dev, rail))
+			failed++;
+	}
+	mxs_power_dev = &pdev->dev;
+	mutex_unlock(&mxs_rails_lock);
+
+	dev_info(&pdev->dev, "%d rails (%d failed) registered in %lld us\n",
+		 num, failed, ktime_us_delta(ktime_get(), start));
 	return 0;
 }
 
 
 int mxs_regulator_remove(struct platform_device *pdev)
 {
-	struct regulator_dev *rdev = platform_get_drvdata(pdev);
+	struct mxs_regulator_rail *rail;
 
-	regulator_unregister(rdev);
+	mutex_lock(&mxs_rails_lock);
+	list_for_each_entry_reverse(rail, &mxs_rails, node)
+		mxs_regulator_del_rail(rail);
+	mxs_power_dev = NULL;
+	mutex_unlock(&mxs_rails_lock);
 
 	return 0;
 
 }
 
+int mxs_register_regulators(struct mxs_regulator_rail *rails, int num)
+{
+	int i;
+	int ret = 0;
+
+	mutex_lock(&mxs_rails_lock);
+	for (i = 0; i < num; i++) {
+		rails[i].rdev = NULL;
+		list_add_tail(&rails[i].node, &mxs_rails);
+		if (mxs_power_dev) {
+			ret = mxs_regulator_add_rail(mxs_power_dev, &rails[i]);
+			if (ret)
+				break;
+		}
+		pr_debug("register regulator %s, %d\n",
+			rails[i].sreg->rdata->name, rails[i].id);
+	}
+	if (ret) {
+		for (; i >= 0; i--) {
+			mxs_regulator_del_rail(&rails[i]);
+			list_del_init(&rails[i].node);
+		}
+	}
+	mutex_unlock(&mxs_rails_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(mxs_register_regulators);
+
+void mxs_unregister_regulators(struct mxs_regulator_rail *rails, int num)
+{
+	int i;
+
+	mutex_lock(&mxs_rails_lock);
+	for (i = num - 1; i >= 0; i--) {
+		/* dropped by a failed mxs_register_regulators() */
+		if (list_empty(&rails[i].node))
+			continue;
+		mxs_regulator_del_rail(&rails[i]);
+		list_del_init(&rails[i].node);
+	}
+	mutex_unlock(&mxs_rails_lock);
+}
+EXPORT_SYMBOL_GPL(mxs_unregister_regulators);
+
 int mxs_register_regulator(
 		struct mxs_regulator *reg_data, int reg,
 			      struct regulator_init_data *initdata)
 {
-	struct platform_device *pdev;
+	struct mxs_regulator_rail *rail;
 	int ret;
 
-	pdev = platform_device_alloc("mxs_reg", reg);
-	if (!pdev)
+	rail = kzalloc(sizeof(*rail), GFP_KERNEL);
+	if (!rail)
 		return -ENOMEM;
 
-	pdev->dev.platform_data = initdata;
+	rail->sreg = reg_data;
+	rail->id = reg;
+	rail->initdata = initdata;
+	rail->allocated = 1;
+	ret = mxs_register_regulators(rail, 1);
+	if (ret)
+		kfree(rail);
 
-	platform_set_drvdata(pdev, reg_data);
-	ret = platform_device_add(pdev);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(mxs_register_regulator);
 
-	if (ret != 0) {
-		pr_debug("Failed to register regulator %d: %d\n",
-			reg, ret);
-		platform_device_del(pdev);
+/* undo mxs_register_regulator() */
+void mxs_unregister_regulator(struct mxs_regulator *reg_data)
+{
+	struct mxs_regulator_rail *rail;
+
+	mutex_lock(&mxs_rails_lock);
+	list_for_each_entry(rail, &mxs_rails, node) {
+		if (rail->sreg != reg_data || !rail->allocated)
+			continue;
+		mxs_regulator_del_rail(rail);
+		list_del(&rail->node);
+		kfree(rail);
+		break;
 	}
-	pr_debug("register regulator %s, %d: %d\n",
-			reg_data->rdata->name, reg, ret);
+	mutex_unlock(&mxs_rails_lock);
+}
+EXPORT_SYMBOL_GPL(mxs_unregister_regulator);
 
-	return ret;
+static int mxs_regulator_resume(struct device *dev)
+{
+	mxs_power_regs_sync();
+	return 0;
 }
-EXPORT_SYMBOL_GPL(mxs_register_regulator);
+
+static const struct dev_pm_ops mxs_regulator_pm_ops = {
+	.resume	= mxs_regulator_resume,
+};
 
 struct platform_driver mxs_reg = {
 	.driver = {
 		.name	= "mxs_reg",
+		.pm	= &mxs_regulator_pm_ops,
 	},
 	.probe	= mxs_regulator_probe,
 	.remove	= mxs_regulator_remove,
@@ -290,12 +427,35 @@ struct platform_driver mxs_reg = {
 
 int mxs_regulator_init(void)
 {
-	return platform_driver_register(&mxs_reg);
+	int ret;
+
+	ret = platform_driver_register(&mxs_reg);
+	if (ret)
+		return ret;
+
+	mxs_power_pdev = platform_device_register_simple("mxs_reg", -1,
+							 NULL, 0);
+	if (IS_ERR(mxs_power_pdev)) {
+		platform_driver_unregister(&mxs_reg);
+		return PTR_ERR(mxs_power_pdev);
+	}
+	return 0;
 }
 
 void mxs_regulator_exit(void)
 {
+	struct mxs_regulator_rail *rail, *tmp;
+
+	platform_device_unregister(mxs_power_pdev);
 	platform_driver_unregister(&mxs_reg);
+
+	mutex_lock(&mxs_rails_lock);
+	list_for_each_entry_safe(rail, tmp, &mxs_rails, node)
+		if (rail->allocated) {
+			list_del(&rail->node);
+			kfree(rail);
+		}
+	mutex_unlock(&mxs_rails_lock);
 }
 
 postcore_initcall(mxs_regulator_init);